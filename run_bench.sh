@@ -0,0 +1,400 @@
+#!/bin/sh
+#
+# Rough performance checks.  Inputs are generated into a scratch directory,
+# BENCH_KEYS scales them.  Run all benchmarks, or name the ones to run:
+#   ./run_bench.sh stdin
+#
+
+BENCH_KEYS=${BENCH_KEYS:-200000}
+BENCH_MB=${BENCH_MB:-100}
+bench_dir=$(mktemp -d /tmp/uclcmd_bench.XXXXXX)
+trap 'rm -rf ${bench_dir}' EXIT
+
+# Print the wall clock seconds taken by a shell command
+bench_time() {
+	/usr/bin/time -p sh -c "$1" 2>&1 >/dev/null | awk '/^real/ { print $2 }'
+}
+
+# Print MB/s given a byte count and seconds
+bench_rate() {
+	awk -v b="$1" -v s="$2" 'BEGIN {
+		if (s <= 0) s = 0.01;
+		printf "%.1f", b / 1048576 / s
+	}'
+}
+
+gen_flat() {
+	[ -f ${bench_dir}/flat.ucl ] && return
+	awk -v n=${BENCH_KEYS} 'BEGIN {
+		for (i = 0; i < n; i++)
+			printf "key_%d = \"value_%d\";\n", i, i
+	}' > ${bench_dir}/flat.ucl
+}
+
+gen_nested() {
+	[ -f ${bench_dir}/nested.ucl ] && return
+	awk 'BEGIN {
+		printf "a { b { c { d { e { f { g { h {\n"
+		for (i = 0; i < 1000; i++)
+			printf "k_%d = \"v_%d\";\n", i, i
+		printf "} } } } } } } }\n"
+	}' > ${bench_dir}/nested.ucl
+}
+
+gen_tree() {
+	[ -f ${bench_dir}/tree.ucl ] && return
+	awk -v n=$((BENCH_KEYS / 10)) 'BEGIN {
+		for (i = 0; i < n; i++) {
+			printf "host_%d { name = \"h%d\"; net {\n", i, i
+			printf "  ip = \"10.0.%d.%d\"; mac = \"m%d\";\n", \
+			    i / 256 % 256, i % 256, i
+			printf "  ports = [ 22, 80, 443 ];\n} }\n"
+		}
+	}' > ${bench_dir}/tree.ucl
+}
+
+gen_records() {
+	[ -f ${bench_dir}/records.ndjson ] && return
+	awk -v n=${BENCH_KEYS} 'BEGIN {
+		for (i = 0; i < n; i++)
+			printf "{\"id\": %d, \"a\": {\"b\": {\"x\": %d}}}\n", i, i
+	}' > ${bench_dir}/records.ndjson
+}
+
+gen_json() {
+	[ -f ${bench_dir}/big.json ] && return
+	awk -v n=${BENCH_KEYS} 'BEGIN {
+		printf "{\"version\": 1,\n\"hosts\": {\n"
+		for (i = 0; i < n; i++)
+			printf "%s\"host_%d\": {\"ip\": \"10.0.%d.%d\", \"ports\": [22, 80]}\n", \
+			    i ? "," : "", i, i / 256 % 256, i % 256
+		printf "}}\n"
+	}' > ${bench_dir}/big.json
+}
+
+bench_stdin() {
+	gen_flat
+	last="key_$((BENCH_KEYS - 1))"
+	res=$(./uclcmd get --noquotes ${last} < ${bench_dir}/flat.ucl)
+	if [ "${res}" != "value_$((BENCH_KEYS - 1))" ]; then
+		echo "Bench[stdin] Failed. got: ${res}"
+		return 1
+	fi
+	size=$(wc -c < ${bench_dir}/flat.ucl)
+	t=$(bench_time "./uclcmd get ${last} < ${bench_dir}/flat.ucl")
+	echo "Bench[stdin] ${size} bytes in ${t}s ($(bench_rate ${size} ${t}) MB/s)"
+}
+
+bench_cache() {
+	gen_flat
+	last="key_$((BENCH_KEYS - 1))"
+	cache=${bench_dir}/cache
+	cold=$(bench_time "./uclcmd get -f ${bench_dir}/flat.ucl ${last}")
+	./uclcmd get --cache-dir ${cache} -f ${bench_dir}/flat.ucl ${last} \
+	    > /dev/null
+	warm=$(bench_time "./uclcmd get --cache-dir ${cache} \
+	    -f ${bench_dir}/flat.ucl ${last}")
+	res=$(./uclcmd get --noquotes --cache-dir ${cache} \
+	    -f ${bench_dir}/flat.ucl ${last})
+	if [ "${res}" != "value_$((BENCH_KEYS - 1))" ]; then
+		echo "Bench[cache] Failed. got: ${res}"
+		return 1
+	fi
+	echo "Bench[cache] parse ${cold}s, cached snapshot ${warm}s"
+}
+
+bench_serve() {
+	gen_flat
+	last="key_$((BENCH_KEYS - 1))"
+	sock=${bench_dir}/uclcmd.sock
+	./uclcmd serve -s ${sock} ${bench_dir}/flat.ucl &
+	server=$!
+	while [ ! -S ${sock} ]; do sleep 0.1; done
+	res=$(./uclcmd --connect ${sock} get --noquotes \
+	    -f ${bench_dir}/flat.ucl ${last})
+	if [ "${res}" != "value_$((BENCH_KEYS - 1))" ]; then
+		echo "Bench[serve] Failed. got: ${res}"
+		kill ${server}
+		return 1
+	fi
+	direct=$(bench_time "for i in 1 2 3 4 5 6 7 8 9 10; do
+	    ./uclcmd get -f ${bench_dir}/flat.ucl ${last}; done")
+	served=$(bench_time "for i in 1 2 3 4 5 6 7 8 9 10; do
+	    ./uclcmd --connect ${sock} get -f ${bench_dir}/flat.ucl ${last}; done")
+	kill ${server}
+	echo "Bench[serve] 10 lookups: direct ${direct}s, served ${served}s"
+}
+
+# Many paths sharing one deep prefix cost about as much as a single path
+bench_multiget() {
+	gen_nested
+	one=$(bench_time "./uclcmd get -f ${bench_dir}/nested.ucl \
+	    a.b.c.d.e.f.g.h.k_0")
+	many=$(bench_time "./uclcmd get -f ${bench_dir}/nested.ucl \
+	    $(awk 'BEGIN { for (i = 0; i < 1000; i++) printf "a.b.c.d.e.f.g.h.k_%d ", i }')")
+	res=$(./uclcmd get -f ${bench_dir}/nested.ucl a.b.c.d.e.f.g.h.k_1 \
+	    a.b.c.d.e.f.g.h.k_999 | tr '\n' ' ')
+	if [ "${res}" != '"v_1" "v_999" ' ]; then
+		echo "Bench[multiget] Failed. got: ${res}"
+		return 1
+	fi
+	echo "Bench[multiget] 1 path ${one}s, 1000 paths ${many}s"
+}
+
+bench_dump() {
+	gen_tree
+	./uclcmd get -k -l -f ${bench_dir}/tree.ucl . > ${bench_dir}/dump.out
+	size=$(wc -c < ${bench_dir}/dump.out)
+	t=$(bench_time "./uclcmd get -k -l -f ${bench_dir}/tree.ucl .")
+	echo "Bench[dump] ${size} bytes out in ${t}s ($(bench_rate ${size} ${t}) MB/s)"
+}
+
+bench_emit() {
+	gen_tree
+	./uclcmd get -j -f ${bench_dir}/tree.ucl . > ${bench_dir}/emit.out
+	size=$(wc -c < ${bench_dir}/emit.out)
+	t=$(bench_time "./uclcmd get -j -f ${bench_dir}/tree.ucl .")
+	echo "Bench[emit] ${size} bytes of JSON in ${t}s ($(bench_rate ${size} ${t}) MB/s)"
+}
+
+bench_ndjson() {
+	gen_tree
+	records=$((BENCH_KEYS / 10))
+	res=$(./uclcmd get --ndjson -f ${bench_dir}/tree.ucl '.|each' | wc -l)
+	if [ ${res} -ne ${records} ]; then
+		echo "Bench[ndjson] Failed. got ${res} records"
+		return 1
+	fi
+	t=$(bench_time "./uclcmd get --ndjson -f ${bench_dir}/tree.ucl '.|each'")
+	echo "Bench[ndjson] ${records} records in ${t}s ($(awk -v n=${records} \
+	    -v s=${t} 'BEGIN { if (s <= 0) s = 0.01; printf "%d", n / s }') records/s)"
+}
+
+bench_stream() {
+	gen_records
+	res=$(./uclcmd get --stream -f ${bench_dir}/records.ndjson a.b.x | \
+	    tail -n 1)
+	if [ "${res}" != "$((BENCH_KEYS - 1))" ]; then
+		echo "Bench[stream] Failed. got: ${res}"
+		return 1
+	fi
+	t=$(bench_time "./uclcmd get --stream -f ${bench_dir}/records.ndjson \
+	    '.a.b|keys'")
+	echo "Bench[stream] ${BENCH_KEYS} records in ${t}s ($(awk \
+	    -v n=${BENCH_KEYS} -v s=${t} \
+	    'BEGIN { if (s <= 0) s = 0.01; printf "%d", n / s }') records/s)"
+}
+
+# A key near the start of a large JSON file, with and without --scan
+bench_scan() {
+	gen_json
+	res=$(./uclcmd get --scan -f ${bench_dir}/big.json hosts.host_1.ip)
+	if [ "${res}" != '"10.0.0.1"' ]; then
+		echo "Bench[scan] Failed. got: ${res}"
+		return 1
+	fi
+	full=$(bench_time "./uclcmd get -f ${bench_dir}/big.json hosts.host_1.ip")
+	scan=$(bench_time "./uclcmd get --scan -f ${bench_dir}/big.json \
+	    hosts.host_1.ip")
+	last=$(bench_time "./uclcmd get --scan -f ${bench_dir}/big.json \
+	    hosts.host_$((BENCH_KEYS - 1)).ip")
+	echo "Bench[scan] parse ${full}s, scan to first key ${scan}s, to last ${last}s"
+}
+
+bench_index() {
+	gen_json
+	key="hosts.host_$((BENCH_KEYS - 1)).ip"
+	full=$(bench_time "./uclcmd get -f ${bench_dir}/big.json ${key}")
+	want=$(./uclcmd get -f ${bench_dir}/big.json ${key})
+	./uclcmd index -f ${bench_dir}/big.json || return 1
+	res=$(./uclcmd get -f ${bench_dir}/big.json ${key})
+	if [ "${res}" != "${want}" ]; then
+		echo "Bench[index] Failed. got: ${res}"
+		return 1
+	fi
+	t=$(bench_time "./uclcmd get -f ${bench_dir}/big.json ${key}")
+	rm -f ${bench_dir}/big.json.uclidx
+	echo "Bench[index] parse ${full}s, indexed ${t}s"
+}
+
+# A lookup walking a msgpack file in place, against decoding all of it
+bench_mpwalk() {
+	gen_json
+	mp=${bench_dir}/big.msgpack
+	./uclcmd get --msgpack -f ${bench_dir}/big.json . > ${mp}
+	key="hosts.host_$((BENCH_KEYS - 1)).ip"
+	want=$(./uclcmd get ${key} < ${mp})
+	res=$(./uclcmd get -f ${mp} ${key})
+	if [ "${res}" != "${want}" ]; then
+		echo "Bench[mpwalk] Failed. got: ${res}"
+		return 1
+	fi
+	full=$(bench_time "./uclcmd get ${key} < ${mp}")
+	walk=$(bench_time "./uclcmd get -f ${mp} ${key}")
+	echo "Bench[mpwalk] decode ${full}s, walk ${walk}s"
+}
+
+# Skipping to the last of BENCH_MB megabytes of JSON, against parsing it all
+bench_structural() {
+	hosts=$((BENCH_MB * 1048576 / 100))
+	json=${bench_dir}/structural.json
+	awk -v n=${hosts} 'BEGIN {
+		printf "{\n"
+		for (i = 0; i < n; i++)
+			printf "%s\"host_%d\": {\"ip\": \"10.0.%d.%d\", \"ports\": [22, 80], \"note\": \"a \\\"quoted\\\" {x}\"}\n", \
+			    i ? "," : "", i, i / 256 % 256, i % 256
+		printf "}\n"
+	}' > ${json}
+	last="host_$((hosts - 1)).ports.1"
+	res=$(./uclcmd get --scan -f ${json} ${last})
+	if [ "${res}" != "80" ]; then
+		echo "Bench[structural] Failed. got: ${res}"
+		return 1
+	fi
+	size=$(wc -c < ${json})
+	impl=$(./uclcmd get -d --scan -f ${json} ${last} 2>&1 >/dev/null | \
+	    awk '/Skipping values with/ { print $NF }')
+	full=$(bench_time "./uclcmd get -f ${json} ${last}")
+	scan=$(bench_time "./uclcmd get --scan -f ${json} ${last}")
+	echo "Bench[structural] ${size} bytes: parse ${full}s" \
+	    "($(bench_rate ${size} ${full}) MB/s), ${impl} scan ${scan}s" \
+	    "($(bench_rate ${size} ${scan}) MB/s)"
+	rm -f ${json}
+}
+
+# Folding fragment files one merge at a time, against one merge of them all
+bench_fragments() {
+	frags=16
+	mkdir -p ${bench_dir}/frag.d
+	for f in $(seq -w 1 ${frags}); do
+		awk -v n=$((BENCH_KEYS / frags)) -v f=${f} 'BEGIN {
+			for (i = 0; i < n; i++)
+				printf "svc_%d { frag_%s = %d; }\n", i, f, i
+		}' > ${bench_dir}/frag.d/${f}.ucl
+	done
+	# Each step re-reads and re-emits everything merged so far
+	cat > ${bench_dir}/chain.sh <<-EOF
+		set -- ${bench_dir}/frag.d/*.ucl
+		cp \$1 ${bench_dir}/chain.ucl
+		shift
+		for f in "\$@"; do
+			./uclcmd merge --ucl -f ${bench_dir}/chain.ucl -i \$f . \\
+			    > ${bench_dir}/chain.tmp || exit 1
+			mv ${bench_dir}/chain.tmp ${bench_dir}/chain.ucl
+		done
+	EOF
+	sh ${bench_dir}/chain.sh || return 1
+	./uclcmd merge --ucl -f ${bench_dir}/frag.d . > ${bench_dir}/folded.ucl
+	if ! cmp -s ${bench_dir}/chain.ucl ${bench_dir}/folded.ucl; then
+		echo "Bench[fragments] Failed. outputs differ"
+		return 1
+	fi
+	t_chain=$(bench_time "sh ${bench_dir}/chain.sh")
+	t_fold=$(bench_time "./uclcmd merge --ucl -f ${bench_dir}/frag.d .")
+	echo "Bench[fragments] ${frags} files: chained ${t_chain}s, one merge ${t_fold}s"
+}
+
+# Merging an overlay of n keys into a base of n keys, half of them shared,
+# at growing n; the time per key should stay flat
+bench_mergescale() {
+	for n in $((BENCH_KEYS / 4)) $((BENCH_KEYS / 2)) ${BENCH_KEYS}; do
+		awk -v n=${n} -v f=${bench_dir}/base_${n}.ucl \
+		    -v o=${bench_dir}/over_${n}.ucl 'BEGIN {
+			for (i = 0; i < n; i++) {
+				printf "svc_%d { port = %d; tags = [ a ]; }\n", i, i > f
+				printf "svc_%d { port = %d; host = h%d; }\n", i + n / 2, i, i > o
+			}
+		}'
+		res=$(./uclcmd merge -c -f ${bench_dir}/base_${n}.ucl \
+		    -i ${bench_dir}/over_${n}.ucl . | ./uclcmd get '.|length')
+		if [ "${res}" != "$((n + n / 2))" ]; then
+			echo "Bench[mergescale] Failed. got: ${res}"
+			return 1
+		fi
+		t=$(bench_time "./uclcmd merge -c -f ${bench_dir}/base_${n}.ucl \
+		    -i ${bench_dir}/over_${n}.ucl .")
+		echo "Bench[mergescale] ${n} keys: ${t}s" \
+		    "($(awk -v t=${t} -v n=${n} 'BEGIN { printf "%.2f", t * 1e6 / n }') us/key)"
+	done
+}
+
+# Structural diff of two big files differing in one leaf, and in one leaf in
+# every hundred, against emitting both and comparing the text
+bench_diff() {
+	gen_json
+	a=${bench_dir}/big.json
+	b=${bench_dir}/diff_one.json
+	c=${bench_dir}/diff_many.json
+	sed 's/"host_7": {"ip": "10.0.0.7"/"host_7": {"ip": "10.9.9.9"/' ${a} > ${b}
+	sed 's/\("host_[0-9]*00": {"ip": "\)10/\111/' ${a} > ${c}
+	res=$(./uclcmd diff ${a} ${b})
+	if [ "${res}" != '~hosts.host_7.ip="10.9.9.9"' ]; then
+		echo "Bench[diff] Failed. got: ${res}"
+		return 1
+	fi
+	many=$(./uclcmd diff ${a} ${c} | wc -l)
+	t_same=$(bench_time "./uclcmd diff ${a} ${a}")
+	t_one=$(bench_time "./uclcmd diff ${a} ${b}")
+	t_many=$(bench_time "./uclcmd diff ${a} ${c}")
+	t_text=$(bench_time "./uclcmd get -c . < ${a} > ${bench_dir}/a.txt; \
+	    ./uclcmd get -c . < ${b} > ${bench_dir}/b.txt; \
+	    diff ${bench_dir}/a.txt ${bench_dir}/b.txt")
+	echo "Bench[diff] identical ${t_same}s, 1 leaf ${t_one}s," \
+	    "${many} leaves ${t_many}s, emit and diff(1) ${t_text}s"
+	rm -f ${b} ${c} ${bench_dir}/a.txt ${bench_dir}/b.txt
+}
+
+# Fingerprint every host subtree, against emitting each one and hashing
+# the text; key order is shuffled in a copy to check the hashes agree
+bench_fingerprint() {
+	gen_tree
+	a=${bench_dir}/tree.ucl
+	b=${bench_dir}/tree_swapped.ucl
+	hosts=$(( BENCH_KEYS / 10 ))
+	awk -v n=${hosts} 'BEGIN {
+		for (i = 0; i < n; i++) {
+			printf "host_%d { net {\n  ports = [ 22, 80, 443 ];\n", i
+			printf "  mac = \"m%d\"; ip = \"10.0.%d.%d\";\n", \
+			    i, i / 256 % 256, i % 256
+			printf "} name = \"h%d\"; }\n", i
+		}
+	}' > ${b}
+	fa=$(./uclcmd get -f ${a} '.|each|fingerprint' | cksum)
+	fb=$(./uclcmd get -f ${b} '.|each|fingerprint' | cksum)
+	if [ "${fa}" != "${fb}" ]; then
+		echo "Bench[fingerprint] Failed. key order changed the hashes"
+		return 1
+	fi
+	t_fp=$(bench_time "./uclcmd get -f ${a} '.|each|fingerprint'")
+	t_emit=$(bench_time "./uclcmd get -c -f ${a} '.|each' | cksum")
+	echo "Bench[fingerprint] ${hosts} subtrees in ${t_fp}s" \
+	    "($(awk -v n=${hosts} -v s=${t_fp} 'BEGIN { if (s <= 0) s = 0.01;
+		printf "%d", n / s }') /s), emit and cksum ${t_emit}s"
+	rm -f ${b}
+}
+
+# Heap allocations per leaf for a shellvars dump, less those of parsing
+bench_allocs() {
+	if ! command -v valgrind > /dev/null; then
+		echo "Bench[allocs] Skipped, needs valgrind"
+		return 0
+	fi
+	gen_tree
+	leaves=$(( BENCH_KEYS / 10 * 6 ))
+	heap_allocs() {
+		valgrind "$@" 2>&1 > /dev/null | \
+		    awk '/total heap usage/ { gsub(",", "", $5); print $5 }'
+	}
+	parse=$(heap_allocs ./uclcmd get -f ${bench_dir}/tree.ucl '.|length')
+	dump=$(heap_allocs ./uclcmd get -l -f ${bench_dir}/tree.ucl .)
+	echo "Bench[allocs] ${leaves} leaves: $(awk -v p=${parse} -v d=${dump} \
+	    -v n=${leaves} 'BEGIN { printf "%.2f", (d - p) / n }') allocs/leaf"
+}
+
+fail=0
+benches=${*:-stdin cache serve multiget allocs dump emit ndjson stream scan structural index mpwalk fragments mergescale diff fingerprint}
+for b in ${benches}; do
+	bench_${b} || fail=$(( $fail + 1 ))
+done
+
+exit $fail
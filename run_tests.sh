@@ -1,26 +1,63 @@
 #!/bin/sh
 
 fail=0
+oldifs=$IFS
 for test_in in tests/*.in; do
+	# Every test is run a second time against a msgpack copy of its input
+	./uclcmd get --msgpack . < $test_in > test.msgpack
+	if [ $? -gt 0 ]; then
+		echo Test[$(basename $test_in .in)/msgpack] Failed. Error encoding input.
+		fail=$(( $fail + 1 ))
+		continue
+	fi
 	for test_cmd in tests/$(basename ${test_in} .in)_*.cmd; do
-		cat $test_in | ./uclcmd $(cat $test_cmd) > test.out
+	    for input in $test_in test.msgpack; do
+		test_name=$(basename $test_cmd .cmd)
+		if [ $input = test.msgpack ]; then
+			test_name=${test_name}/msgpack
+		fi
+		# The first line is split into words, each line after it
+		# is passed as a single argument
+		set -f
+		set -- $(head -n 1 $test_cmd)
+		IFS='
+'
+		set -- "$@" $(tail -n +2 $test_cmd)
+		IFS=$oldifs
+		set +f
+		cat $input | ./uclcmd "$@" > test.out
 		e=$?
 		if [ $e -gt 0 ]; then
-			echo Test[$(basename $test_cmd .cmd)] Failed. Error.
+			echo Test[$test_name] Failed. Error.
 			fail=$(( $fail + 1 ))
 		else
 			res=$(diff -u tests/$(basename $test_cmd .cmd).res test.out)
 			if [ $? -gt 0 ]; then
-				echo Test[$(basename $test_cmd .cmd)] Failed. did not match.
+				echo Test[$test_name] Failed. did not match.
 				echo "$res"
 				fail=$(( $fail + 1 ))
 			else
-				echo Test[$(basename $test_cmd .cmd)] Passed.
+				echo Test[$test_name] Passed.
 			fi
 		fi
-
+	    done
 	done
 done
+rm -f test.msgpack
 
-exit $fail
+# Tests that need files set up, or more than one command, are scripts
+# that exit non-zero and say why when they fail
+for test_sh in tests/*.sh; do
+	[ -f $test_sh ] || continue
+	test_name=$(basename $test_sh .sh)
+	res=$(sh $test_sh 2>&1)
+	if [ $? -gt 0 ]; then
+		echo Test[$test_name] Failed.
+		echo "$res"
+		fail=$(( $fail + 1 ))
+	else
+		echo Test[$test_name] Passed.
+	fi
+done
 
+exit $fail
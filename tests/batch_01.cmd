@@ -0,0 +1 @@
+batch -n --ucl tests/batch_01.ops
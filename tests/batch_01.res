@@ -0,0 +1,12 @@
+rootkey {
+    subkey {
+        key = "newvalue";
+        child = "value";
+    }
+    array [
+        "b",
+        "c",
+        "d",
+    ]
+    new = "auto-string";
+}
@@ -0,0 +1,63 @@
+#!/bin/sh
+# get --cache-dir answers from a snapshot exactly as a parse does, and
+# does not use it once the size, mtime or content of the source changes
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf $tmp' EXIT
+src=$tmp/src.ucl
+cache=$tmp/cache
+
+fail() {
+	echo "$*"
+	exit 1
+}
+
+# Compare a get through the cache with a plain parse, $2 is whether the
+# snapshot should have been used, the rest are the get arguments (-j .)
+check() {
+	name=$1
+	expect=$2
+	shift 2
+	[ $# -gt 0 ] || set -- -j .
+	want=$(./uclcmd get -f $src "$@")
+	got=$(./uclcmd get -d --cache-dir $cache -f $src "$@" 2> $tmp/err)
+	[ "$got" = "$want" ] || fail "$name: got '$got', expected '$want'"
+	if grep -q "from cached snapshot" $tmp/err; then
+		used=yes
+	else
+		used=no
+	fi
+	[ $used = $expect ] || fail "$name: snapshot used: $used, expected $expect"
+}
+
+printf 'a { b = 1; c = [ x, y ]; }\nd = "text";\n' > $src
+check "first run" no
+ls $cache/*.uclcache > /dev/null 2>&1 || fail "no snapshot written"
+check "unchanged" yes
+
+# Same inode, size and mtime, only the content differs
+touch -r $src $tmp/ref
+sed 's/text/txet/' $src > $tmp/new
+cat $tmp/new > $src
+touch -r $tmp/ref $src
+check "content changed" no
+check "content changed, cached again" yes
+
+echo 'e = 2;' >> $src
+check "size changed" no
+check "size changed, cached again" yes
+
+touch -d '2001-01-01 00:00:00' $src
+check "mtime changed" no
+check "mtime changed, cached again" yes
+
+# msgpack turns a time into a float and drops the heredoc and repeated key
+# markers, such trees are parsed every time
+printf 't = 10s;\nh = <<EOD\nline one\nline two\nEOD\nr = 1;\nr = 2;\n' > $src
+for args in "t|type" "-u ." "-u r" "-j ."; do
+	check "lossy '$args', cold" no $args
+	check "lossy '$args', warm" no $args
+done
+grep -q "Not caching" $tmp/err || fail "lossy tree: no reason given"
+
+exit 0
@@ -0,0 +1 @@
+get --canonical -c -f tests/canonical_01.ucl .
@@ -0,0 +1 @@
+{"alpha":{"host":"x","nested":{"a":1,"z":true},"port":22},"list":[3,1,2],"ratio":0.0,"zone":"b"}
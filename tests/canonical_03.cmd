@@ -0,0 +1 @@
+get --canonical .|keys
@@ -0,0 +1,4 @@
+alpha
+list
+ratio
+zone
@@ -0,0 +1 @@
+get --canonical --shellvars --keys --expand .|recurse
@@ -0,0 +1,16 @@
+__keys="alpha list ratio zone"
+alpha={object}
+alpha__keys="host nested port"
+alpha_host="x"
+alpha_nested={object}
+alpha_nested__keys="a z"
+alpha_nested_a=1
+alpha_nested_z=true
+alpha_port=22
+list=[array]
+list__length=3
+list_0=3
+list_1=1
+list_2=2
+ratio=0.000000
+zone="b"
@@ -0,0 +1 @@
+compile --annotate tests/compile_01.d
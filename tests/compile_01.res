@@ -0,0 +1,9 @@
+# tests/compile_01.d/10-base.ucl:1
+server {
+    # tests/compile_01.d/20-site.ucl:3
+    port = 8080;
+    # tests/compile_01.d/10-base.ucl:3
+    host = "a";
+}
+# tests/compile_01.d/20-site.ucl:5
+debug = true;
@@ -0,0 +1 @@
+compile tests/compile_01.d/*.ucl
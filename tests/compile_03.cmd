@@ -0,0 +1 @@
+compile --annotate --canonical tests/compile_01.d
@@ -0,0 +1,5 @@
+debug = true;
+server {
+    host = "a";
+    port = 8080;
+}
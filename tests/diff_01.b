@@ -0,0 +1,12 @@
+ports = [ 80, 8443, 9000 ];
+name = "svc";
+db {
+	port = 5432;
+	host = "b";
+}
+same {
+	x {
+		y = 1;
+	}
+}
+new = "yes";
@@ -0,0 +1 @@
+diff tests/diff_01.a tests/diff_01.b
@@ -0,0 +1,5 @@
+~ports.1=8443
++ports.2=9000
+~db.host="b"
+-old=true
++new="yes"
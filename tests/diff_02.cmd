@@ -0,0 +1 @@
+diff tests/diff_01.b tests/diff_01.b
@@ -0,0 +1 @@
+get --ucl -f tests/get.in rootkey.subkey
@@ -0,0 +1,2 @@
+key = "value";
+child = "value";
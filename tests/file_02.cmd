@@ -0,0 +1 @@
+get --ucl -f tests/include-merge-high.in .
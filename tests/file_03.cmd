@@ -0,0 +1 @@
+get --noquotes -f tests/file_03.msgpack servers.1.name servers.21.n missing version
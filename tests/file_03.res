@@ -0,0 +1,4 @@
+beta
+19
+null
+3
@@ -0,0 +1 @@
+get .|each|fingerprint
@@ -0,0 +1,6 @@
+4b4100729747d13d
+4b4100729747d13d
+7f85b0f91d63746c
+40ca62c01ae95101
+40ca62c01ae95101
+f84feaf158031f3d
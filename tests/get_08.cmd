@@ -0,0 +1 @@
+get --ucl rootkey.subkey.key rootkey.array.1 rootkey.missing .rootkey.subkey.child|type
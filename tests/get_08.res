@@ -0,0 +1,4 @@
+"value"
+"b"
+null
+string
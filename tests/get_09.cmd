@@ -0,0 +1,2 @@
+get --keys
+rootkey|.array.2 .subkey.key .missing
@@ -0,0 +1,3 @@
+rootkey.array.2="c"
+rootkey.subkey.key="value"
+rootkey.missing=null
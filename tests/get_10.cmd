@@ -0,0 +1 @@
+get --msgpack --framed rootkey.array|each
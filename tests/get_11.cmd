@@ -0,0 +1 @@
+get --ndjson rootkey.array|each
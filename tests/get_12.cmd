@@ -0,0 +1 @@
+get --ndjson --keys rootkey.subkey|each
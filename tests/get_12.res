@@ -0,0 +1,2 @@
+{"path":"rootkey.subkey.key","value":"value"}
+{"path":"rootkey.subkey.child","value":"value"}
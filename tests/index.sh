@@ -0,0 +1,97 @@
+#!/bin/sh
+# get answers from the sidecar index exactly as from a full parse, the
+# index follows the verbs that write the file (set, batch and patch), and
+# one that no longer matches the file, or is corrupt, is not used
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf $tmp' EXIT
+src=$tmp/data.json
+
+fail() {
+	echo "$*"
+	exit 1
+}
+
+# Compare a get of $1 from src with one from a copy that has no index, $2
+# is whether the index should have answered
+check() {
+	cp $src $tmp/plain.json
+	want=$(./uclcmd get -j -f $tmp/plain.json $1)
+	got=$(./uclcmd get -d -j -f $src $1 2> $tmp/err)
+	[ "$got" = "$want" ] || fail "$1: got '$got', expected '$want'"
+	if grep -q "from index" $tmp/err; then
+		used=yes
+	else
+		used=no
+	fi
+	[ $used = $2 ] || fail "$1: index used: $used, expected $2"
+}
+
+cat > $src <<'JSON'
+{
+	"version": 3,
+	"servers": [
+		{ "name": "alpha", "ports": [ 22, 443 ] },
+		{ "name": "beta", "ports": [ 80 ], "tags": { "env": "prod" } }
+	]
+}
+JSON
+./uclcmd index -f $src || fail "index failed"
+[ -f $src.uclidx ] || fail "no index written"
+
+check version yes
+check servers.1.name yes
+check servers.0.ports.1 yes
+check servers.1.tags.env yes
+check servers.1 yes
+check missing no
+check servers.7.name no
+check servers.1.tags.none no
+
+# Touched, the content still matches so the index is still used, and
+# takes the new identity so the file is not hashed again
+touch -d '2001-01-01 00:00:00' $src
+check servers.1.name yes
+grep -q "Updated the identity" $tmp/err || fail "identity not updated"
+check servers.0.name yes
+! grep -q "Updated the identity" $tmp/err || fail "source hashed again"
+
+# Rewritten by set, batch and patch
+./uclcmd set -j -f $src servers.0.name gamma || fail "set failed"
+check servers.0.name yes
+check servers.1.tags.env yes
+printf 'merge servers.1 zone = b\nremove version\n' > $tmp/ops
+./uclcmd batch -j -f $src $tmp/ops || fail "batch failed"
+check servers.1.zone yes
+check servers.1.ports.0 yes
+check version no
+check servers.1.name yes
+printf '[ { "op": "add", "path": "/servers/0/ports/0", "value": 8 } ]\n' \
+    > $tmp/patch.json
+./uclcmd patch -j -f $src $tmp/patch.json || fail "patch failed"
+check servers.0.ports.0 yes
+check servers.0.ports.2 yes
+
+# Changed behind our back: stale
+sed 's/beta/betamax/' $src > $tmp/new
+cat $tmp/new > $src
+check servers.1.name no
+check servers.0.ports.1 no
+./uclcmd index -f $src || fail "reindex failed"
+check servers.1.name yes
+
+# Corrupt or truncated
+cp $src.uclidx $tmp/good.uclidx
+printf 'not an index' > $src.uclidx
+check servers.1.name no
+head -c 100 $tmp/good.uclidx > $src.uclidx
+check servers.1.name no
+cp $tmp/good.uclidx $src.uclidx
+check servers.1.name yes
+
+# Written back as UCL the file can not be indexed, so the index goes
+./uclcmd set -u -f $src servers.0.name delta || fail "set -u failed"
+[ ! -f $src.uclidx ] || fail "index kept for a UCL file"
+check servers.0.name no
+
+exit 0
@@ -0,0 +1 @@
+merge --ucl -i tests/merge_10.d .
@@ -0,0 +1,13 @@
+rootkey {
+    subkey {
+        key = "second";
+        child = "value";
+        newkey = "one";
+    }
+    array [
+        "a",
+        "b",
+        "c",
+    ]
+}
+extra = "yes";
@@ -0,0 +1 @@
+merge --ucl --policy=append -i tests/merge_11.ucl .
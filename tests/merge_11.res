@@ -0,0 +1,15 @@
+rootkey {
+    subkey {
+        key [
+            "value",
+            "second",
+        ]
+        child = "value";
+    }
+    array [
+        "a",
+        "b",
+        "c",
+        "d",
+    ]
+}
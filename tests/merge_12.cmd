@@ -0,0 +1 @@
+merge --ucl -i tests/merge_12.ucl .
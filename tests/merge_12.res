@@ -0,0 +1,11 @@
+rootkey {
+    subkey {
+        key = "new";
+    }
+    array [
+        "a",
+        "b",
+        "c",
+        "d",
+    ]
+}
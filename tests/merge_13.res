@@ -0,0 +1,15 @@
+rootkey {
+    subkey {
+        key = "value";
+        child = "value";
+    }
+    array [
+        "a",
+        "b",
+        "c",
+    ]
+}
+x [
+    1,
+    2,
+]
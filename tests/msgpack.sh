@@ -0,0 +1,45 @@
+#!/bin/sh
+# get -f on a msgpack file answers as the full parser does, also when a
+# key on the way is repeated, which libucl gathers into an array
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf $tmp' EXIT
+src=$tmp/dup.msgpack
+
+fail() {
+	echo "$*"
+	exit 1
+}
+
+# Compare a get of $1 from src with the full parser reading it from a
+# pipe, $2 is whether the walk should have answered
+check() {
+	want=$(cat $src | ./uclcmd get -j -f - $1)
+	got=$(./uclcmd get -d -j -f $src $1 2> $tmp/err)
+	[ "$got" = "$want" ] || fail "$1: got '$got', expected '$want'"
+	if grep -q "^DEBUG: Scanned" $tmp/err; then
+		used=yes
+	else
+		used=no
+	fi
+	[ $used = $2 ] || fail "$1: walked: $used, expected $2"
+}
+
+# {"a": 1, "b": 3, "a": 2, "x": {"c": 4, "c": 5}, "y": {"d": 6}}
+printf '\205\241a\001\241b\003\241a\002\241x\202\241c\004\241c\005' > $src
+printf '\241y\201\241d\006' >> $src
+
+check a no
+check x.c no
+# Repeats that are not on the way do not matter
+check b yes
+check x yes
+check y.d yes
+
+# The same document without the repeats can be walked
+printf '\203\241a\001\241x\201\241c\004\241y\201\241d\006' > $src
+check a yes
+check x.c yes
+check y.d yes
+
+exit 0
@@ -0,0 +1,33 @@
+#!/bin/sh
+# A patch test operation compares values exactly: a float that differs
+# by less than 1 fails it, and a failed test leaves the file as it was
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf $tmp' EXIT
+src=$tmp/src.ucl
+
+fail() {
+	echo "$*"
+	exit 1
+}
+
+printf 'name = "svc";\nratio = 0.9;\n' > $src
+cp $src $tmp/orig
+
+cat > $tmp/patch.json <<'JSON'
+[
+	{ "op": "test", "path": "/ratio", "value": 0.5 },
+	{ "op": "replace", "path": "/name", "value": "changed" }
+]
+JSON
+./uclcmd patch -f $src $tmp/patch.json 2> $tmp/err &&
+    fail "test of 0.9 against 0.5 passed"
+grep -q "Test of /ratio failed" $tmp/err || fail "no test failure reported"
+cmp -s $src $tmp/orig || fail "file changed after a failed test"
+
+sed 's/0\.5/0.9/' $tmp/patch.json > $tmp/patch2.json
+./uclcmd patch -f $src $tmp/patch2.json || fail "test of 0.9 against 0.9 failed"
+got=$(./uclcmd get -f $src name)
+[ "$got" = "changed" ] || fail "name: got '$got', expected 'changed'"
+
+exit 0
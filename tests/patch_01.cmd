@@ -0,0 +1 @@
+patch -n --ucl tests/patch_01.json
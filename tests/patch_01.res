@@ -0,0 +1,14 @@
+ports [
+    8080,
+    443,
+    9000,
+]
+db {
+    host = "b";
+    port = 5432;
+    replica_port = 5432;
+}
+service = "svc";
+tags [
+    "x",
+]
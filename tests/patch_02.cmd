@@ -0,0 +1 @@
+patch -n --ucl tests/patch_02.json
@@ -0,0 +1,10 @@
+name = "svc2";
+ports [
+    1,
+]
+db {
+    port = 5432;
+    tls {
+        on = true;
+    }
+}
@@ -0,0 +1 @@
+patch -n -c tests/patch_03.json
@@ -0,0 +1 @@
+{"name":"svc","ports":[80,443],"db":{"host":"a","port":5432},"arr":[{"host":"a","port":5432,"z":3},{"b":2,"y":2},{"a":1,"x":1}]}
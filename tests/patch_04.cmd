@@ -0,0 +1 @@
+patch -n -c tests/patch_04.json
@@ -0,0 +1 @@
+{"name":"equal","ports":[80,443],"db":{"host":"a","port":5432}}
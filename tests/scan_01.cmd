@@ -0,0 +1 @@
+get --scan --noquotes -f tests/scan_01.json servers.1.name servers.1.ports.1 missing servers|length
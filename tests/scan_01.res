@@ -0,0 +1,4 @@
+beta
+80
+null
+2
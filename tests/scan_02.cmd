@@ -0,0 +1 @@
+get --scan --ucl -f tests/get.in rootkey.subkey
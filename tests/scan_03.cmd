@@ -0,0 +1 @@
+get --scan --noquotes -f tests/scan_03.json after1 after2 after3 after4 tail.x
@@ -0,0 +1,5 @@
+ok1
+ok2
+ok3
+ok4
+end
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Requests through uclcmd serve are answered from the resident tree, which
+# is reloaded when the file changes, and give the same output, exit status
+# and file permissions as running uclcmd directly
+
+tmp=$(mktemp -d) || exit 1
+sock=$tmp/sock
+server=
+trap '[ -n "$server" ] && kill $server; rm -rf $tmp' EXIT
+
+fail() {
+	echo "$*"
+	exit 1
+}
+
+# Run a get through the server, $1 is the expected output
+served_get() {
+	want=$1
+	shift
+	got=$(./uclcmd --connect $sock get -d "$@" 2> $tmp/err)
+	[ "$got" = "$want" ] || fail "get $*: got '$got', expected '$want'"
+	grep -q "Using resident tree" $tmp/err ||
+	    fail "get $*: not answered from the resident tree"
+}
+
+printf 'host { name = "alpha"; ports = [ 22, 80 ]; }\n' > $tmp/served.ucl
+printf 'extra = "local";\n' > $tmp/other.ucl
+./uclcmd get -m -f $tmp/other.ucl . > $tmp/other.msgpack
+
+./uclcmd serve --input-format ucl -s $sock $tmp/served.ucl &
+server=$!
+i=0
+while [ ! -S $sock ]; do
+	i=$(( $i + 1 ))
+	[ $i -lt 50 ] || fail "server did not start"
+	sleep 0.1
+done
+
+served_get '"alpha"' -f $tmp/served.ucl host.name
+served_get '80' -f $tmp/served.ucl host.ports.1
+# Without -f, get reads the one served file
+served_get '"alpha"' host.name < /dev/null
+
+# --input-format given to serve is only for the served files
+got=$(./uclcmd --connect $sock get -f - extra < $tmp/other.msgpack)
+[ "$got" = '"local"' ] || fail "--input-format leaked into request: '$got'"
+
+./uclcmd get -j -f $tmp/other.ucl -o $tmp/direct.json . || fail "direct -o"
+./uclcmd --connect $sock get -j -f $tmp/other.ucl -o $tmp/served.json . ||
+    fail "served -o"
+cmp -s $tmp/direct.json $tmp/served.json || fail "-o output differs"
+[ "$(stat -c %a $tmp/served.json 2> /dev/null || stat -f %Lp $tmp/served.json)" = \
+    "$(stat -c %a $tmp/direct.json 2> /dev/null || stat -f %Lp $tmp/direct.json)" ] ||
+    fail "-o through the server has different permissions"
+
+./uclcmd --connect $sock get -f $tmp/missing.ucl . > /dev/null 2>&1
+[ $? -eq 2 ] || fail "exit status of a failed request not returned"
+
+# A served file changed on disk is reloaded, and still answered from memory
+printf 'host { name = "beta"; }\n' > $tmp/new.ucl
+mv $tmp/new.ucl $tmp/served.ucl
+served_get '"beta"' -f $tmp/served.ucl host.name
+
+exit 0
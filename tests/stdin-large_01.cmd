@@ -0,0 +1 @@
+get --keys --noquotes key_0999
@@ -0,0 +1 @@
+key_0999=value_0999
@@ -0,0 +1 @@
+get --stream --noquotes -f tests/stream_01.ndjson host.name
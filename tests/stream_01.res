@@ -0,0 +1,4 @@
+alpha
+beta
+null
+gamma
@@ -0,0 +1 @@
+get --stream --noquotes -f tests/stream_02.msgpack host.name
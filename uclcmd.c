@@ -35,16 +35,20 @@
  */
 
 int debug = 0, expand = 0, mode = 0, noop = 0, nonewline = 0;
-int show_keys = 0, show_raw = 0;
+int canonical = 0, framed = 0, show_keys = 0, show_raw = 0;
 int pflags = 0;
 bool firstline = true, shvars = false;
 int output_type = 254;
+enum ucl_parse_type input_format = UCL_PARSE_AUTO;
+enum merge_policy merge_policy = MERGE_MERGE;
 ucl_object_t *root_obj = NULL;
 ucl_object_t *set_obj = NULL;
+ucl_object_t *annotations = NULL;
 struct ucl_parser *parser = NULL;
 struct ucl_parser *setparser = NULL;
 char input_sepchar = '.';
 char output_sepchar = '.';
+const char *cache_dir = NULL;
 const char *filename = NULL;
 const char *outfile = NULL;
 FILE *output = NULL;
@@ -57,29 +61,49 @@ char *include_file = NULL;
  * http://xkcd.com/1513/
  *
  */
+static verbmap_t cmdmap[] =
+{
+	{ "get", get_main },
+	{ "set", set_main },
+	{ "merge", merge_main },
+	{ "remove", remove_main },
+	{ "del", remove_main },
+	{ "batch", batch_main },
+	{ "patch", patch_main },
+	{ "compile", compile_main },
+	{ "diff", diff_main },
+	{ "index", index_main },
+	{ "dump", output_main },
+	{ "serve", serve_main },
+	{ "--connect", connect_main },
+	{ "help", (verb_func_t) usage },
+	{ "version", (verb_func_t) version },
+	{ NULL, NULL }
+};
+
 int
 main(int argc, char *argv[])
 {
-    int ret = 0, i = 0;
-    bool verbfound = false;
-    verbmap_t cmdmap[] =
-    {
-	    { "get", get_main },
-	    { "set", set_main },
-	    { "merge", merge_main },
-	    { "remove", remove_main },
-	    { "del", remove_main },
-	    { "dump", output_main },
-	    { "help", (verb_func_t) usage },
-	    { "version", (verb_func_t) version },
-	    { NULL, NULL }
-    };
 
     if (argc < 2) {
 	usage();
     }
 
     output = stdout;
+    /* Error paths exit() directly, do not lose buffered output */
+    atexit(output_flush);
+
+    return(verb_main(argc, argv));
+}
+
+/*
+ * Run the verb named in argv[1], also used by uclcmd serve to run requests
+ */
+int
+verb_main(int argc, char *argv[])
+{
+    int ret = 0, i = 0;
+    bool verbfound = false;
 
     for (i = 0; cmdmap[i].verb; i++) {
 	if (strcasecmp(cmdmap[i].verb, argv[1]) != 0)
@@ -111,18 +135,31 @@ void
 usage()
 {
     fprintf(stderr, "%s\n",
-"Usage: uclcmd get [-cdeIjklmNquy] [-D char] [-f file] [-o file] variable\n"
+"Usage: uclcmd get [-cdeIjklmNquy] [-D char] [-f file] [-o file]\n"
+"                  [--cache-dir dir] [--framed] [--ndjson] [--scan] [--stream]\n"
+"                  variable\n"
 "       uclcmd set [-cdIjmnuy] [-t type] [-D char] [-f file] [-i file] [-o file] variable [UCL]\n"
 "       uclcmd merge [-cdIjmnuy] [-D char] [-f file] [-i file] [-o file] variable\n"
 "       uclcmd remove [-cdIjmnuy] [-D char] [-f file] [-o file] variable\n"
+"       uclcmd batch [-cdIjmnuy] [-D char] [-f file] [-o file] [operations]\n"
+"       uclcmd patch [-cdIjmnuy] [-f file] [-o file] [patch]\n"
+"       uclcmd compile [-acdIjmuy] [-D char] [-o file] [--policy policy]\n"
+"                      fragment ...\n"
+"       uclcmd diff [-dIlNqx] [-D char] [-o file] a b\n"
+"       uclcmd index [-d] -f file\n"
+"       uclcmd serve [-dI] -s socket file ...\n"
+"       uclcmd --connect socket get|set|merge|remove|dump [options] ...\n"
 "\n"
 "COMMON OPTIONS:\n"
 "       -c --cjson      output compacted JSON\n"
+"          --canonical  sort keys and normalize values, so that the same data\n"
+"                       is always output byte for byte the same\n"
 "       -d --debug      enable verbose debugging output\n"
 "       -D --delimiter  character to use as element delimiter (default is .)\n"
 "       -e --expand     Output the list of keys when encountering an object\n"
 "       -f --file       path to a file to read or write\n"
 "       -I --foldcase   fold all keys to lowercase (make matching insensitive)\n"
+"          --input-format  ucl, msgpack or auto (default, detect msgpack)\n"
 "       -j --json       output pretty JSON\n"
 "       -k --keys       show key=value rather than just the value\n"
 "       -l --shellvars  keys are output with underscores as delimiter\n"
@@ -138,15 +175,75 @@ usage()
 "       UCL             A block of UCL to be written to the specified variable\n"
 "\n"
 "GET OPTIONS:\n"
+"          --cache-dir  keep parsed snapshots of -f files in this directory\n"
+"          --framed     with --msgpack, prefix each value written with its\n"
+"                       length as a 32 bit big endian integer, --keys is\n"
+"                       ignored\n"
+"          --ndjson     output one compact JSON document per line, with -k\n"
+"                       each is {\"path\": ..., \"value\": ...}\n"
+"          --scan       read only as much of a JSON file as needed to find\n"
+"                       the variables, other input is parsed as usual.\n"
+"                       msgpack files given with -f are always read this way\n"
+"          --stream     input is a stream of records, one JSON/UCL document\n"
+"                       per line or concatenated msgpack values, and the\n"
+"                       variables are read from each record in turn\n"
 "\n"
 "SET OPTIONS:\n"
 "       -i --input      use indicated file as additional input (for combining)\n"
 "\n"
 "MERGE OPTIONS:\n"
-"       -i --input      use indicated file as additional input (for merging)\n"
+"       -f --file       may be repeated, or name a directory (its *.ucl files) or\n"
+"                       a glob; the files are parsed in parallel and merged in\n"
+"                       order, later files taking priority\n"
+"       -i --input      use indicated file as additional input (for merging),\n"
+"                       multiple files, directories and globs are merged as -f\n"
+"       --policy        how a key already set is merged: error, replace, merge\n"
+"                       (default: objects merged, arrays joined, others\n"
+"                       replaced) or append; an object may set its own with\n"
+"                       a \".merge\" = policy; key\n"
 "\n"
 "REMOVE OPTIONS:\n"
 "\n"
+"BATCH OPTIONS:\n"
+"       operations      file (default STDIN) of lines to apply in order:\n"
+"                         set [-t type] variable UCL\n"
+"                         merge variable UCL\n"
+"                         remove variable\n"
+"                       the file is written once, and only if all succeed\n"
+"       --policy        merge policy, as for merge\n"
+"\n"
+"PATCH OPTIONS:\n"
+"       patch           file (default STDIN) holding a JSON Patch (RFC 6902,\n"
+"                       an array of operations, test included) or a JSON\n"
+"                       Merge Patch (RFC 7386, an object); the file is\n"
+"                       written once, and only if the whole patch applies\n"
+"\n"
+"COMPILE OPTIONS:\n"
+"       fragment        file, directory (its *.ucl files) or glob, merged in\n"
+"                       order as merge -f does\n"
+"       -a --annotate   precede each value with a comment naming the fragment\n"
+"                       and line it came from (UCL output only, not with\n"
+"                       --canonical)\n"
+"       --policy        merge policy, as for merge\n"
+"\n"
+"DIFF OPTIONS:\n"
+"       a b             files to compare, - for STDIN; each path that differs\n"
+"                       is written as -key=old (only in a), +key=new (only in\n"
+"                       b) or ~key=new (changed)\n"
+"       -x --exit-code  exit with 1 if there are differences\n"
+"\n"
+"INDEX OPTIONS:\n"
+"       -f --file       JSON file to index, the index is written to file.uclidx\n"
+"                       and used by get of a single variable while it matches\n"
+"                       the file, set, batch and patch keep it up to date\n"
+"\n"
+"SERVE OPTIONS:\n"
+"       -s --socket     path of the unix socket to listen on\n"
+"       file            files to keep parsed, get -f requests for them are\n"
+"                       answered without parsing, changed files are reloaded.\n"
+"                       With one file, get without -f reads it (-f - reads\n"
+"                       STDIN)\n"
+"\n"
 "EXAMPLES:\n"
 "       uclcmd get --file vmconfig .name\n"
 "           \"value\"\n"
@@ -182,9 +279,13 @@ cleanup()
     if (set_obj != NULL) {
 	ucl_object_unref(set_obj);
     }
+    if (annotations != NULL) {
+	ucl_object_unref(annotations);
+    }
     if (nonewline) {
-	fprintf(output, "\n");
+	output_char('\n');
     }
+    output_flush();
     if (output != stdout) {
 	output_close(output);
     }
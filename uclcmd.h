@@ -34,16 +34,26 @@
 #ifndef UCLCMD_H_
 #define UCLCMD_H_
 
+#include <ctype.h>
 #include <errno.h>
+#include <float.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <ucl.h>
 
@@ -59,80 +69,264 @@
 #define UCLCMD_VERSION			UCLCMD_VERSION_MAJOR.UCLCMD_VERSION_MINOR.UCLCMD_VERSION_PATCH
 #define UCLCMD_VERSION_STRING	EXPAND_AND_QUOTE(UCLCMD_VERSION)
 
+/* Output types beyond enum ucl_emitter, the default is text (254) */
+#define	UCLCMD_EMIT_NDJSON	253
+
 #define UCLCMD_PARSER_FLAGS	UCL_PARSER_NO_IMPLICIT_ARRAYS | \
 				UCL_PARSER_SAVE_COMMENTS
 
-extern int debug, expand, noop, nonewline, show_keys, show_raw;
+/* How merge_recursive() resolves a key that is on both sides */
+enum merge_policy {
+	MERGE_ERROR = 0,
+	MERGE_REPLACE,
+	MERGE_MERGE,
+	MERGE_APPEND
+};
+
+extern int canonical, debug, expand, framed, noop, nonewline, show_keys, show_raw;
 extern int pflags;
 extern bool firstline, shvars;
 extern int output_type;
+extern enum ucl_parse_type input_format;
+extern enum merge_policy merge_policy;
 extern ucl_object_t *root_obj;
 extern ucl_object_t *set_obj;
+extern ucl_object_t *annotations;
 extern struct ucl_parser *parser;
 extern struct ucl_parser *setparser;
 extern char input_sepchar;
 extern char output_sepchar;
+extern const char *cache_dir;
 extern const char *filename;
 extern const char *outfile;
 extern FILE *output;
 extern char *include_file;
 
+typedef struct path_trie {
+	char			*seg;		/* segment, NULL for the root */
+	size_t			seglen;
+	int			depth;
+	bool			terminal;	/* a requested path ends here */
+	struct path_trie	*parent;
+	struct path_trie	*children;
+	struct path_trie	*next;		/* sibling */
+	const ucl_object_t	*obj;		/* resolved object or NULL */
+	bool			scanned;	/* seen by scan_file() */
+	size_t			scan_off;	/* where scan_file() found it */
+	size_t			scan_len;
+} path_trie_t;
+
+/* Opcodes of a compiled get command program */
+enum get_op {
+	GET_OP_END = 0,
+	GET_OP_DUMP,
+	GET_OP_EACH,
+	GET_OP_FINGERPRINT,
+	GET_OP_ITERATE,
+	GET_OP_KEYS,
+	GET_OP_LENGTH,
+	GET_OP_NONE,		/* look up one or more subpaths */
+	GET_OP_RECURSE,
+	GET_OP_TYPE,
+	GET_OP_VALUES
+};
+
+typedef struct get_seg {
+	char		*name;
+	size_t		len;
+} get_seg_t;
+
+typedef struct get_path {
+	char		*text;		/* path as given, used as the output key */
+	get_seg_t	*segs;
+	int		nsegs;
+} get_path_t;
+
+typedef struct get_insn {
+	enum get_op	op;
+	const char	*name;		/* command as given */
+	get_path_t	*paths;		/* GET_OP_NONE only */
+	int		npaths;
+} get_insn_t;
+
+/* The '|' separated commands after a path, terminated by GET_OP_END */
+typedef struct get_prog {
+	get_insn_t	*insns;
+	int		len;
+	char		*buf;		/* storage for the command names */
+} get_prog_t;
+
+/* A node path built up in place while walking the tree */
+typedef struct nodepath {
+	char		*buf;
+	size_t		len;
+	size_t		size;
+} nodepath_t;
+
+extern const nodepath_t nodepath_root;
+
+/* Called by parse_stream() with each record */
+typedef void (*stream_func_t)(const ucl_object_t *obj, void *ud);
+
 typedef int (*verb_func_t)(int argc, char *argv[]);
 
+/* A walk of an object by canonical_iterate(), start it zeroed */
+typedef struct canon_iter {
+	ucl_object_iter_t	it;
+	struct canon_member	*members;	/* sorted, with --canonical */
+	size_t			next;
+	size_t			count;
+} canon_iter_t;
+
+/* Subtree hashes, kept by uclcmd_diff.c */
+struct hashmemo;
+
+/* Files named on the command line, with directories and patterns expanded */
+typedef struct filelist {
+	char		**names;
+	int		count;
+	int		size;
+} filelist_t;
+
+/* One file for parse_files() */
+typedef struct parse_job {
+	const char	*name;
+	int		flags;		/* parser flags */
+	ucl_object_t	*obj;		/* result */
+	int		error;		/* exit code parse_file() would use */
+} parse_job_t;
+
 typedef struct verbmap {
 	const char *verb;
 	verb_func_t callback;
 } verbmap_t;
 
+int batch_main(int argc, char *argv[]);
+ucl_object_t* cache_load(const char *filename);
+void cache_store(const ucl_object_t *obj);
+double canonical_double(double val);
+ucl_object_t* canonical_copy(const ucl_object_t *obj);
+const ucl_object_t* canonical_iterate(const ucl_object_t *obj, canon_iter_t *ci,
+    bool expand);
+void canonical_iterate_free(canon_iter_t *ci);
 void cleanup();
+int compile_main(int argc, char *argv[]);
+int connect_main(int argc, char *argv[]);
+enum ucl_parse_type detect_input_format(const unsigned char *data, size_t len);
+int diff_main(int argc, char *argv[]);
 char* expand_subkeys(const ucl_object_t *obj, char *nodepath);
+void filelist_add(filelist_t *list, const char *arg);
+void filelist_free(filelist_t *list);
+get_prog_t* get_compile(const char *commands);
 int get_main(int argc, char *argv[]);
 void get_mode(char *requested_node);
+const ucl_object_t* get_path_lookup(const ucl_object_t *obj,
+    const get_path_t *path);
+void get_prog_free(get_prog_t *prog);
 ucl_object_t* get_object(char *selected_node);
 ucl_object_t* get_parent(char *selected_node);
+uint64_t hash_buffer(const void *data, size_t len);
+uint64_t hash_canonical(const ucl_object_t *obj);
+uint64_t hash_object(const ucl_object_t *obj, struct hashmemo *memo);
+const ucl_object_t* index_lookup(const char *src, const char *path);
+int index_main(int argc, char *argv[]);
+void index_refresh(const char *src);
+const ucl_object_t* lookup_segment(const ucl_object_t *obj, const char *seg,
+    size_t len);
+ucl_object_t* merge_fold(parse_job_t *jobs, int njobs);
 int merge_main(int argc, char *argv[]);
 int merge_mode(char *destination_node, char *data);
-bool merge_recursive(ucl_object_t *top, ucl_object_t *elt, bool copy);
-void output_chunk(const ucl_object_t *obj, char *nodepath, const char *inkey);
+uint64_t msgpack_be(const unsigned char *p, size_t n);
+size_t msgpack_header(const unsigned char *data, size_t len, ucl_type_t *type,
+    uint64_t *count);
+ssize_t msgpack_skip(const unsigned char *data, size_t len);
+void nodepath_free(nodepath_t *path);
+void nodepath_init(nodepath_t *path, const char *str);
+void nodepath_pop(nodepath_t *path, size_t mark);
+size_t nodepath_push(nodepath_t *path, const char *seg, size_t len, int sep);
+size_t nodepath_push_index(nodepath_t *path, unsigned int index, int sep);
+bool merge_recursive(ucl_object_t *top, const ucl_object_t *elt,
+    enum merge_policy policy);
+void output_chunk(const ucl_object_t *obj, const nodepath_t *path,
+    size_t keymark);
 FILE * output_open(const char *output_filename);
+void output_char(char c);
 void output_close(FILE *out);
-int replace_file(const ucl_object_t *obj, char *nodepath, const char *inkey,
-    const char *output_filename);
+bool output_emit(const ucl_object_t *obj, enum ucl_emitter type,
+    const ucl_object_t *comments);
+void output_float(double val);
+void output_flush(void);
+void output_framed(const ucl_object_t *obj);
+void output_int(intmax_t val);
+void output_json_string(const char *str, size_t len);
+int replace_file(const ucl_object_t *obj, const char *output_filename);
 int output_main(int argc, char *argv[]);
-void output_key(const ucl_object_t *obj, char *nodepath, const char *inkey);
+void output_path(const nodepath_t *path, char suffix);
+void output_key(const ucl_object_t *obj, const nodepath_t *path);
+void output_str(const char *str);
+void output_write(const void *data, size_t len);
+bool parse_chunk(struct ucl_parser *parser, const unsigned char *data,
+    size_t len, enum ucl_parse_type type);
 ucl_object_t* parse_file(struct ucl_parser *parser, const char *filename);
+ucl_object_t* parse_file_common(struct ucl_parser *parser, const char *filename,
+    int *error);
+void parse_files(parse_job_t *jobs, int njobs);
 ucl_object_t* parse_input(struct ucl_parser *parser, FILE *source);
+int parse_stream(int fd, stream_func_t callback, void *ud);
 ucl_object_t* parse_string(struct ucl_parser *parser, char *data);
-int process_get_command(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
+int patch_main(int argc, char *argv[]);
+void pathcache_enable(bool on);
+void pathcache_flush(void);
+int process_get_command(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+unsigned char* read_input(int fd, size_t *len);
 int remove_main(int argc, char *argv[]);
-void replace_sep(char *key, int oldsep, int newsep);
+bool scan_file(const char *filename, path_trie_t *trie, bool json);
+const unsigned char* scan_skip(const unsigned char *p,
+    const unsigned char *end);
+const unsigned char* scan_string(const unsigned char *p,
+    const unsigned char *end);
+const unsigned char* scan_ws(const unsigned char *p, const unsigned char *end);
+const unsigned char* structural_skip(const unsigned char *p,
+    const unsigned char *end);
+bool remove_mode(char *requested_node);
+int serve_main(int argc, char *argv[]);
+ucl_object_t* serve_lookup(const char *filename);
 int set_main(int argc, char *argv[]);
 int set_mode(char *destination_node, char *data, ucl_type_t obj_type);
+enum ucl_parse_type string_to_format(const char *strformat);
+enum merge_policy string_to_policy(const char *strpolicy);
 ucl_type_t string_to_type (const char *strtype);
+void trie_free(path_trie_t *node);
+path_trie_t* trie_insert(path_trie_t *root, const char *path);
+path_trie_t* trie_new(void);
+void trie_resolve(path_trie_t *node, const ucl_object_t *obj);
 char * type_as_string (ucl_type_t type);
 char * objtype_as_string (const ucl_object_t *obj);
 void ucl_obj_dump(const ucl_object_t *obj, unsigned int shift);
 void ucl_obj_dump_safe(const ucl_object_t *obj, unsigned int shift);
 void usage();
+int verb_main(int argc, char *argv[]);
 void version();
 
-int get_cmd_each(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_iterate(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_keys(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_length(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_none(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_recurse(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_type(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
-int get_cmd_values(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse);
+int get_cmd_each(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_fingerprint(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_iterate(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_keys(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_length(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_none(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_recurse(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_type(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
+int get_cmd_values(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse);
 
 void uclcmd_asprintf(char ** __restrict s, char const * __restrict fmt, ...)
     __printflike(2, 3);
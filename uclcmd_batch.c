@@ -0,0 +1,295 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+#include "uclcmd.h"
+
+/*
+ * Split the next whitespace separated word off of *line
+ */
+static char*
+batch_token(char **line)
+{
+    char *p = *line, *tok = NULL;
+
+    while (*p == ' ' || *p == '\t') {
+	p++;
+    }
+    if (*p == '\0') {
+	*line = p;
+	return NULL;
+    }
+    tok = p;
+    while (*p != '\0' && *p != ' ' && *p != '\t') {
+	p++;
+    }
+    if (*p != '\0') {
+	*p++ = '\0';
+    }
+    *line = p;
+
+    return tok;
+}
+
+/*
+ * Apply one operation line to root_obj, returns false on failure
+ */
+static bool
+batch_op(char *line)
+{
+    char *verb = NULL, *node = NULL, *data = NULL, *end = NULL;
+    ucl_type_t want_type = UCL_NULL;
+    bool success = false;
+
+    verb = batch_token(&line);
+    if (verb == NULL || verb[0] == '#') {
+	/* Blank line or comment */
+	return true;
+    }
+    node = batch_token(&line);
+    if (node != NULL && strcmp(node, "-t") == 0) {
+	want_type = string_to_type(batch_token(&line));
+	node = batch_token(&line);
+    }
+    if (node == NULL) {
+	fprintf(stderr, "Error: no variable given for %s\n", verb);
+	return false;
+    }
+    /* Whatever remains is the value, which may contain spaces */
+    while (*line == ' ' || *line == '\t') {
+	line++;
+    }
+    end = line + strlen(line);
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t' ||
+	    end[-1] == '\r')) {
+	*--end = '\0';
+    }
+    if (*line != '\0') {
+	data = line;
+    }
+
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: batch %s %s %s\n", verb, node,
+	    data != NULL ? data : "");
+    }
+
+    /* Each operation gets a fresh parser for its value */
+    if (setparser != NULL) {
+	ucl_parser_free(setparser);
+	setparser = NULL;
+    }
+
+    if (strcasecmp(verb, "set") == 0) {
+	if (data == NULL) {
+	    fprintf(stderr, "Error: no value given to set %s\n", node);
+	    return false;
+	}
+	success = set_mode(node, data, want_type);
+    } else if (strcasecmp(verb, "merge") == 0) {
+	if (data == NULL) {
+	    fprintf(stderr, "Error: no value given to merge into %s\n", node);
+	    return false;
+	}
+	success = merge_mode(node, data);
+    } else if (strcasecmp(verb, "remove") == 0 ||
+	    strcasecmp(verb, "del") == 0) {
+	success = remove_mode(node);
+    } else {
+	fprintf(stderr, "Error: unknown batch operation: %s\n", verb);
+	return false;
+    }
+
+    if (set_obj != NULL) {
+	ucl_object_unref(set_obj);
+	set_obj = NULL;
+    }
+
+    return success;
+}
+
+int
+batch_main(int argc, char *argv[])
+{
+    int ret = 0, ch, fd, lineno = 0;
+    unsigned char *ops = NULL;
+    char *cur = NULL, *line = NULL;
+    size_t opslen = 0;
+    bool success = false;
+
+    /* When modifying, don't expand macros */
+    pflags |= UCL_PARSER_DISABLE_MACRO;
+
+    /* Set the default output type */
+    output_type = UCL_EMIT_CONFIG;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "canonical",	no_argument,		&canonical,	1 },
+	{ "cjson",	no_argument,		&output_type,
+	    UCL_EMIT_JSON_COMPACT },
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "delimiter",	required_argument,	NULL,		'D' },
+	{ "file",	required_argument,	NULL,		'f' },
+	{ "json",	no_argument,		&output_type,
+	    UCL_EMIT_JSON },
+	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
+	{ "msgpack",	no_argument,		&output_type,
+	    UCL_EMIT_MSGPACK },
+	{ "noop",	no_argument,		&noop,		1 },
+	{ "output",	required_argument,	NULL,		'o' },
+	{ "policy",	required_argument,	NULL,		'P' },
+	{ "ucl",	no_argument,		&output_type,
+	    UCL_EMIT_CONFIG },
+	{ "yaml",	no_argument,		&output_type,	UCL_EMIT_YAML },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "cdD:f:Ijmno:uy", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'c':
+	    output_type = UCL_EMIT_JSON_COMPACT;
+	    break;
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'D':
+	    input_sepchar = optarg[0];
+	    output_sepchar = optarg[0];
+	    break;
+	case 'f':
+	    filename = optarg;
+	    break;
+	case 'I':
+	    pflags |= UCL_PARSER_KEY_LOWERCASE;
+	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 'P':
+	    merge_policy = string_to_policy(optarg);
+	    break;
+	case 'j':
+	    output_type = UCL_EMIT_JSON;
+	    break;
+	case 'm':
+	    output_type = UCL_EMIT_MSGPACK;
+	    break;
+	case 'n':
+	    noop = 1;
+	    break;
+	case 'o':
+	    outfile = optarg;
+	    output = output_open(outfile);
+	    break;
+	case 'u':
+	    output_type = UCL_EMIT_CONFIG;
+	    break;
+	case 'y':
+	    output_type = UCL_EMIT_YAML;
+	    break;
+	case 0:
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Read all of the operations before touching anything */
+    if (argc == 0 || strcmp(argv[0], "-") == 0) {
+	if (filename == NULL || strcmp(filename, "-") == 0) {
+	    fprintf(stderr, "Error: the config (-f) and the operations can "
+		"not both come from STDIN\n");
+	    exit(1);
+	}
+	ops = read_input(STDIN_FILENO, &opslen);
+    } else {
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1) {
+	    fprintf(stderr, "Error: cannot open %s: %s\n", argv[0],
+		strerror(errno));
+	    exit(2);
+	}
+	ops = read_input(fd, &opslen);
+	close(fd);
+    }
+
+    /* Initialize parser */
+    parser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
+
+    /* Parse the original UCL */
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+	/* Input from STDIN */
+	root_obj = parse_input(parser, stdin);
+    } else {
+	root_obj = parse_file(parser, filename);
+    }
+
+    /* Apply every operation to the one tree, any failure aborts the lot */
+    cur = (char *)ops;
+    while ((line = strsep(&cur, "\n")) != NULL) {
+	lineno++;
+	if (!batch_op(line)) {
+	    fprintf(stderr, "Error: batch operation on line %d failed, "
+		"no changes were written\n", lineno);
+	    free(ops);
+	    cleanup();
+	    exit(1);
+	}
+    }
+    free(ops);
+
+    /* Then write the result exactly once */
+    if (noop == 0) {
+	if (outfile == NULL && filename != NULL) {
+	    outfile = filename;
+	    success = replace_file(root_obj, outfile);
+	    if (success != 0) {
+		fprintf(stderr, "Error: failed to write the changes to %s\n",
+		    outfile);
+		exit(7);
+	    }
+	} else {
+	    output_chunk(root_obj, &nodepath_root, 0);
+	}
+    } else {
+	get_mode("");
+    }
+
+    cleanup();
+
+    return(ret);
+}
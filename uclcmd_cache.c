@@ -0,0 +1,314 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Parsed snapshot cache
+ *
+ * get -f file --cache-dir dir keeps a msgpack image of the parsed tree in
+ * dir, keyed on the identity of the source file (device, inode, size, mtime),
+ * the parser flags and a hash of its contents.  Any mismatch discards the
+ * snapshot and the file is parsed (and cached) again.  Trees that msgpack
+ * can not hold exactly (time values, heredocs, keys that need quoting,
+ * repeated keys) are never cached, a snapshot must answer as the parse does.
+ */
+
+#include "uclcmd.h"
+
+#define	CACHE_MAGIC	"UCLCACHE"
+#define	CACHE_VERSION	1
+
+struct cache_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	pflags;
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	hash;
+	uint64_t	payload_len;
+};
+
+static struct cache_header cache_want;
+static char *cache_path = NULL;
+
+static bool
+cache_key(const char *filename, struct cache_header *key)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+	return false;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+	close(fd);
+	return false;
+    }
+
+    memset(key, 0, sizeof(*key));
+    memcpy(key->magic, CACHE_MAGIC, sizeof(key->magic));
+    key->version = CACHE_VERSION;
+    key->pflags = UCLCMD_PARSER_FLAGS | pflags;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    key->size = st.st_size;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (st.st_size > 0) {
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+	    close(fd);
+	    return false;
+	}
+	(void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+	key->hash = hash_buffer(map, st.st_size);
+	munmap(map, st.st_size);
+    } else {
+	key->hash = hash_buffer("", 0);
+    }
+    close(fd);
+
+    return true;
+}
+
+static bool
+cache_write(int fd, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    ssize_t w;
+
+    while (len > 0) {
+	w = write(fd, p, len);
+	if (w < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	p += w;
+	len -= w;
+    }
+
+    return true;
+}
+
+/*
+ * Return true if obj comes back from msgpack exactly as it went in: the
+ * type of a time value and the flags that only steer the emitters are lost
+ */
+static bool
+cache_lossless(const ucl_object_t *obj)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+
+    if (obj->flags & (UCL_OBJECT_NEED_KEY_ESCAPE | UCL_OBJECT_MULTILINE |
+	    UCL_OBJECT_MULTIVALUE | UCL_OBJECT_BINARY)) {
+	return false;
+    }
+    switch (ucl_object_type(obj)) {
+    case UCL_TIME:
+    case UCL_USERDATA:
+	return false;
+    case UCL_OBJECT:
+    case UCL_ARRAY:
+	while ((cur = ucl_object_iterate(obj, &it, true))) {
+	    if (!cache_lossless(cur)) {
+		return false;
+	    }
+	}
+	break;
+    default:
+	break;
+    }
+
+    return true;
+}
+
+static void
+cache_discard(const char *reason)
+{
+
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Discarding cache %s: %s\n", cache_path, reason);
+    }
+    unlink(cache_path);
+}
+
+/*
+ * Return the cached tree for filename, or NULL if there is no valid
+ * snapshot.  On a miss the key is remembered for cache_store().
+ */
+ucl_object_t*
+cache_load(const char *filename)
+{
+    struct cache_header hdr;
+    struct ucl_parser *cparser = NULL;
+    ucl_object_t *obj = NULL;
+    unsigned char *map = NULL;
+    struct stat st;
+    int fd;
+
+    free(cache_path);
+    cache_path = NULL;
+    if (!cache_key(filename, &cache_want)) {
+	return NULL;
+    }
+    uclcmd_asprintf(&cache_path, "%s/%jx-%jx.uclcache", cache_dir,
+	(uintmax_t)cache_want.dev, (uintmax_t)cache_want.ino);
+
+    fd = open(cache_path, O_RDONLY);
+    if (fd == -1) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: No cached snapshot %s\n", cache_path);
+	}
+	return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr)) {
+	close(fd);
+	cache_discard("truncated");
+	return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	return NULL;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.payload_len != st.st_size - sizeof(hdr)) {
+	munmap(map, st.st_size);
+	cache_discard("truncated");
+	return NULL;
+    }
+    hdr.payload_len = 0;
+    if (memcmp(&hdr, &cache_want, sizeof(hdr)) != 0) {
+	munmap(map, st.st_size);
+	cache_discard("source has changed");
+	return NULL;
+    }
+
+    /* A private parser, so a bad snapshot can not poison the real one */
+    cparser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
+    if (ucl_parser_add_chunk_full(cparser, map + sizeof(hdr),
+	    st.st_size - sizeof(hdr), 0, UCL_DUPLICATE_APPEND,
+	    UCL_PARSE_MSGPACK)) {
+	obj = ucl_parser_get_object(cparser);
+    }
+    ucl_parser_free(cparser);
+    munmap(map, st.st_size);
+
+    if (obj == NULL) {
+	cache_discard("corrupt snapshot");
+	return NULL;
+    }
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Loaded %s from cached snapshot %s\n",
+	    filename, cache_path);
+    }
+    free(cache_path);
+    cache_path = NULL;
+
+    return obj;
+}
+
+/*
+ * Write a snapshot of obj under the key computed by the last cache_load().
+ * Failing to write the cache is never fatal.
+ */
+void
+cache_store(const ucl_object_t *obj)
+{
+    struct cache_header hdr;
+    unsigned char *payload = NULL;
+    char *tmp_path = NULL;
+    size_t len = 0;
+    bool success = false;
+    int fd;
+
+    if (cache_path == NULL || obj == NULL) {
+	return;
+    }
+    if (!cache_lossless(obj)) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Not caching %s: msgpack can not hold "
+		"the tree exactly\n", cache_path);
+	}
+	goto out;
+    }
+
+    payload = ucl_object_emit_len(obj, UCL_EMIT_MSGPACK, &len);
+    if (payload == NULL) {
+	goto out;
+    }
+
+    (void)mkdir(cache_dir, 0700);
+    uclcmd_asprintf(&tmp_path, "%s.XXXXXXXXXX", cache_path);
+    fd = mkstemp(tmp_path);
+    if (fd == -1) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Unable to create %s: %s\n", tmp_path,
+		strerror(errno));
+	}
+	goto out;
+    }
+
+    hdr = cache_want;
+    hdr.payload_len = len;
+    success = cache_write(fd, &hdr, sizeof(hdr)) &&
+	cache_write(fd, payload, len);
+    if (close(fd) != 0) {
+	success = false;
+    }
+    if (success && rename(tmp_path, cache_path) != 0) {
+	success = false;
+    }
+    if (!success) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Unable to write %s: %s\n", cache_path,
+		strerror(errno));
+	}
+	unlink(tmp_path);
+	goto out;
+    }
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Cached snapshot of %zu bytes in %s\n", len,
+	    cache_path);
+    }
+
+out:
+    free(payload);
+    free(tmp_path);
+    free(cache_path);
+    cache_path = NULL;
+}
@@ -0,0 +1,228 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Canonical output
+ *
+ * libucl keeps the members of an object in the order they were inserted,
+ * so two files holding the same data can be output differently.  With
+ * --canonical, objects are walked in key order and what is emitted is a
+ * copy of the tree with its members sorted and its values normalized:
+ * implicit arrays become explicit ones, times become floats, -0.0 becomes
+ * 0.0 and strings lose the flags that change how they are quoted.  Each
+ * object is sorted once, from an array of its keys made in a single pass.
+ */
+
+#include "uclcmd.h"
+
+struct canon_member {
+	const char		*key;
+	size_t			len;
+	const ucl_object_t	*obj;
+};
+
+static int
+canonical_cmp(const void *a, const void *b)
+{
+    const struct canon_member *x = a, *y = b;
+    int c;
+
+    c = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+    if (c != 0) {
+	return c;
+    }
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+/*
+ * The members of obj sorted by key, in an array the caller frees
+ */
+static struct canon_member*
+canonical_sort(const ucl_object_t *obj, size_t *count)
+{
+    struct canon_member *members;
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    size_t n = 0, size;
+
+    size = obj->len > 0 ? obj->len : 1;
+    members = malloc(size * sizeof(*members));
+    if (members == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    while ((cur = ucl_object_iterate(obj, &it, true))) {
+	if (n == size) {
+	    size *= 2;
+	    members = realloc(members, size * sizeof(*members));
+	    if (members == NULL) {
+		fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		    ENOMEM);
+		abort();
+	    }
+	}
+	members[n].key = ucl_object_keyl(cur, &members[n].len);
+	if (members[n].key == NULL) {
+	    members[n].key = "";
+	    members[n].len = 0;
+	}
+	members[n].obj = cur;
+	n++;
+    }
+    qsort(members, n, sizeof(*members), canonical_cmp);
+    *count = n;
+
+    return members;
+}
+
+/* A float as it is output in canonical form, -0.0 becomes 0.0 */
+double
+canonical_double(double val)
+{
+
+    return val == 0 ? 0.0 : val;
+}
+
+/*
+ * Same as ucl_iterate_object(), but with --canonical the members of an
+ * object are returned in key order.  Only an object walked with expand
+ * set is sorted, without it the walk is of an implicit array.  A walk
+ * left before its end must be finished with canonical_iterate_free().
+ */
+const ucl_object_t*
+canonical_iterate(const ucl_object_t *obj, canon_iter_t *ci, bool expand)
+{
+
+    if (canonical == 0 || expand == false ||
+	    ucl_object_type(obj) != UCL_OBJECT) {
+	return ucl_iterate_object(obj, &ci->it, expand);
+    }
+    if (ci->members == NULL && ci->next == 0) {
+	ci->members = canonical_sort(obj, &ci->count);
+    }
+    if (ci->next >= ci->count) {
+	canonical_iterate_free(ci);
+	return NULL;
+    }
+
+    return ci->members[ci->next++].obj;
+}
+
+void
+canonical_iterate_free(canon_iter_t *ci)
+{
+
+    free(ci->members);
+    ci->members = NULL;
+}
+
+/*
+ * The value of a member: a key given more than once becomes an array
+ */
+static ucl_object_t*
+canonical_member(const ucl_object_t *obj)
+{
+    ucl_object_t *copy;
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+
+    if (obj->next == NULL || ucl_object_type(obj) == UCL_ARRAY) {
+	return canonical_copy(obj);
+    }
+    copy = ucl_object_typed_new(UCL_ARRAY);
+    while ((cur = ucl_object_iterate(obj, &it, false))) {
+	ucl_array_append(copy, canonical_copy(cur));
+    }
+
+    return copy;
+}
+
+/*
+ * A copy of obj and everything below it with sorted keys and normalized
+ * values, that emits the same however obj was written
+ */
+ucl_object_t*
+canonical_copy(const ucl_object_t *obj)
+{
+    struct canon_member *members;
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    ucl_object_t *copy;
+    const char *str;
+    size_t count, i, len;
+
+    switch (ucl_object_type(obj)) {
+    case UCL_OBJECT:
+	members = canonical_sort(obj, &count);
+	copy = ucl_object_typed_new(UCL_OBJECT);
+	if (count > 8) {
+	    ucl_object_reserve(copy, count);
+	}
+	/* Inserted in key order, which is the order they are emitted in */
+	for (i = 0; i < count; i++) {
+	    ucl_object_insert_key(copy, canonical_member(members[i].obj),
+		members[i].key, members[i].len, true);
+	}
+	free(members);
+	break;
+    case UCL_ARRAY:
+	copy = ucl_object_typed_new(UCL_ARRAY);
+	while ((cur = ucl_object_iterate(obj, &it, true))) {
+	    ucl_array_append(copy, canonical_copy(cur));
+	}
+	break;
+    case UCL_INT:
+	copy = ucl_object_fromint(ucl_object_toint(obj));
+	break;
+    case UCL_FLOAT:
+    case UCL_TIME:
+	copy = ucl_object_fromdouble(canonical_double(
+	    ucl_object_todouble(obj)));
+	break;
+    case UCL_STRING:
+	str = ucl_object_tolstring(obj, &len);
+	copy = ucl_object_fromlstring(str, len);
+	break;
+    case UCL_BOOLEAN:
+	copy = ucl_object_frombool(ucl_object_toboolean(obj));
+	break;
+    case UCL_NULL:
+	copy = ucl_object_typed_new(UCL_NULL);
+	break;
+    default:
+	copy = ucl_object_copy(obj);
+	break;
+    }
+    if (copy == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    return copy;
+}
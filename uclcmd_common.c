@@ -52,23 +52,52 @@ uclcmd_asprintf(char ** __restrict s, char const * __restrict fmt, ...)
 	abort();
 }
 
+/*
+ * Fast 64-bit content hash (FNV-1a over 64-bit words), used to tell whether
+ * a file has changed.  This is not meant to resist deliberate collisions.
+ */
+uint64_t
+hash_buffer(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint64_t h = 0xcbf29ce484222325ULL, w;
+
+	while (len >= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h ^= w;
+		h *= 0x100000001b3ULL;
+		h ^= h >> 29;
+		p += sizeof(w);
+		len -= sizeof(w);
+	}
+	while (len > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+		len--;
+	}
+	h ^= h >> 32;
+
+	return h;
+}
+
 char*
 expand_subkeys(const ucl_object_t *obj, char *nodepath)
 {
 	char *result = NULL;
 	int count = 0;
-	ucl_object_iter_t it = NULL;
+	canon_iter_t ci = { NULL };
 	const ucl_object_t *cur;
 
 	result = malloc(1024); /* XXX: use sbuf instead */
 	result[0] = '\0';
 	if (obj != NULL) {
 	    /* Compile a list of the keys in the current object */
-	    while ((cur = ucl_iterate_object(obj, &it, true))) {
+	    while ((cur = canonical_iterate(obj, &ci, true))) {
 		if (!ucl_object_key(cur))
 		    continue;
 		if (strlen(result) > (1024 - 5 - strlen(ucl_object_key(cur)))) {
 			result = strcat(result, " ...");
+			canonical_iterate_free(&ci);
 			break;
 		}
 		if (count)
@@ -80,6 +109,65 @@ expand_subkeys(const ucl_object_t *obj, char *nodepath)
 	return result;
 }
 
+/*
+ * Containers that get_parent() and get_object() found for a path prefix,
+ * so that a run of operations on neighbouring paths does not walk the tree
+ * down from the root for each one.  Only enabled by callers that flush it
+ * whenever an operation may have freed a container.
+ */
+#define	PATHCACHE_SIZE	64
+
+static struct pathcache_entry {
+	char		*prefix;
+	ucl_object_t	*obj;
+} pathcache[PATHCACHE_SIZE];
+static bool pathcache_on = false;
+
+void
+pathcache_flush(void)
+{
+    int k;
+
+    for (k = 0; k < PATHCACHE_SIZE; k++) {
+	free(pathcache[k].prefix);
+	pathcache[k].prefix = NULL;
+	pathcache[k].obj = NULL;
+    }
+}
+
+void
+pathcache_enable(bool on)
+{
+
+    pathcache_flush();
+    pathcache_on = on;
+}
+
+static ucl_object_t*
+lookup_prefix(const char *prefix)
+{
+    struct pathcache_entry *e;
+    ucl_object_t *obj;
+
+    if (!pathcache_on) {
+	return __DECONST(ucl_object_t *,
+	    ucl_lookup_path_char(root_obj, prefix, input_sepchar));
+    }
+    e = &pathcache[hash_buffer(prefix, strlen(prefix)) % PATHCACHE_SIZE];
+    if (e->prefix != NULL && strcmp(e->prefix, prefix) == 0) {
+	return e->obj;
+    }
+    obj = __DECONST(ucl_object_t *,
+	ucl_lookup_path_char(root_obj, prefix, input_sepchar));
+    if (obj != NULL) {
+	free(e->prefix);
+	e->prefix = strdup(prefix);
+	e->obj = e->prefix != NULL ? obj : NULL;
+    }
+
+    return obj;
+}
+
 ucl_object_t*
 get_object(char *selected_node)
 {
@@ -106,8 +194,7 @@ get_object(char *selected_node)
 	 */
 	dst_frag[0] = '\0';
 	dst_frag++;
-	parent_obj = __DECONST(ucl_object_t *,
-	    ucl_lookup_path_char(root_obj, dst_prefix, input_sepchar));
+	parent_obj = lookup_prefix(dst_prefix);
 	if (parent_obj == NULL) {
 	    free(dst_prefix);
 	    return NULL;
@@ -160,8 +247,7 @@ get_parent(char *selected_node)
 	 */
 	dst_frag[0] = '\0';
 	dst_frag++;
-	parent_obj = __DECONST(ucl_object_t *,
-	    ucl_lookup_path_char(root_obj, dst_prefix, input_sepchar));
+	parent_obj = lookup_prefix(dst_prefix);
     }
 
     free(dst_prefix);
@@ -173,17 +259,121 @@ get_parent(char *selected_node)
     return parent_obj;
 }
 
+/*
+ * Resolve one path segment below obj, the same way ucl_lookup_path_char()
+ * treats each element of a path: arrays are indexed by number, anything
+ * else is looked up as a key.
+ */
+const ucl_object_t*
+lookup_segment(const ucl_object_t *obj, const char *seg, size_t len)
+{
+    char *end = NULL;
+    unsigned long index;
+
+    if (obj == NULL || len == 0) {
+	return NULL;
+    }
+    if (ucl_object_type(obj) == UCL_ARRAY) {
+	/* seg is a NUL terminated copy or ends at a separator */
+	index = strtoul(seg, &end, 10);
+	if (end != seg + len) {
+	    return NULL;
+	}
+	return ucl_array_find_index(obj, index);
+    }
+
+    return ucl_object_lookup_len(obj, seg, len);
+}
+
+/*
+ * Node paths are built in one buffer as the tree is walked: a segment is
+ * pushed before descending and popped again afterwards, so no path is
+ * allocated per node.  Separators and the characters of each segment are
+ * translated for output once, as they are pushed.
+ */
+static char nodepath_root_buf[1];
+const nodepath_t nodepath_root = { nodepath_root_buf, 0, 0 };
+
+static inline char
+nodepath_char(char c)
+{
+    if (shvars == true && c == '.') {
+	c = '_';
+    }
+    if (c == input_sepchar) {
+	c = output_sepchar;
+    }
+    return c;
+}
+
+void
+nodepath_init(nodepath_t *path, const char *str)
+{
+    path->size = 256;
+    path->len = 0;
+    path->buf = malloc(path->size);
+    if (path->buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    path->buf[0] = '\0';
+    nodepath_push(path, str, strlen(str), 0);
+}
+
 void
-replace_sep(char *key, int oldsep, int newsep)
+nodepath_free(nodepath_t *path)
+{
+    free(path->buf);
+    path->buf = NULL;
+    path->len = path->size = 0;
+}
+
+/*
+ * Append sep (unless it is 0) and seg to the path.  Returns the previous
+ * length, to be passed to nodepath_pop().
+ */
+size_t
+nodepath_push(nodepath_t *path, const char *seg, size_t len, int sep)
 {
-    char *ptr;
+    size_t mark = path->len, i;
 
-    if (oldsep == newsep) return;
-    ptr = key;
-    while ((ptr = strchr(ptr, oldsep)) != NULL) {
-	    *ptr = newsep;
-	    ptr++;
+    if (path->len + len + 2 > path->size) {
+	while (path->len + len + 2 > path->size) {
+	    path->size *= 2;
+	}
+	path->buf = realloc(path->buf, path->size);
+	if (path->buf == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		ENOMEM);
+	    abort();
+	}
+    }
+    if (sep != 0) {
+	path->buf[path->len++] = nodepath_char(sep);
+    }
+    for (i = 0; i < len; i++) {
+	path->buf[path->len++] = nodepath_char(seg[i]);
     }
+    path->buf[path->len] = '\0';
+
+    return mark;
+}
+
+size_t
+nodepath_push_index(nodepath_t *path, unsigned int index, int sep)
+{
+    char num[16];
+    int len;
+
+    len = snprintf(num, sizeof(num), "%u", index);
+    return nodepath_push(path, num, len, sep);
+}
+
+void
+nodepath_pop(nodepath_t *path, size_t mark)
+{
+    path->len = mark;
+    path->buf[mark] = '\0';
 }
 
 ucl_type_t
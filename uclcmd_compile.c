@@ -0,0 +1,469 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Layered config compilation
+ *
+ * uclcmd compile merges an ordered list of fragments, as merge -f does, and
+ * keeps track of where each value in the result came from.  Rather than a
+ * file name on every node, the origin of a value is a source id (its index
+ * in the list of fragments) and a line number, 16 bytes in a side table
+ * keyed on the object's address.  The table holds a reference on each value
+ * in it, so the values a merge overrides are not freed and an address never
+ * comes to stand for two values; all the fragments are in memory at once
+ * while parse_files() runs anyway.
+ *
+ * libucl does not keep positions, so the line of a key is found by looking
+ * for it in the fragment's text, forward from the previous key, in the order
+ * the parser kept.  A key that cannot be found (from an .include, say, or in
+ * msgpack) gets line 0.
+ */
+
+#include "uclcmd.h"
+
+#define ORIGIN_SRC_MAX	UINT16_MAX
+
+typedef struct origin {
+	const ucl_object_t	*obj;		/* NULL for a free slot */
+	uint32_t		line;
+	uint16_t		src;
+} origin_t;
+
+static struct {
+	origin_t	*slots;
+	size_t		size;		/* a power of 2 */
+	size_t		count;
+} origins;
+
+/* Where origin_locate() is in the text of a fragment */
+struct locate_ctx {
+	const char	*cur;
+	const char	*end;
+	uint32_t	line;		/* of cur */
+	uint16_t	src;
+	bool		fold;		/* keys were lowercased by the parser */
+};
+
+static size_t
+origin_slot(const ucl_object_t *obj, size_t size)
+{
+    uint64_t h = (uintptr_t)obj;
+
+    /* Objects are at least 16 byte aligned, spread the rest over the table */
+    h = (h >> 4) * 0x9e3779b97f4a7c15ULL;
+
+    return (h >> 32) & (size - 1);
+}
+
+/* Put obj in the table, the caller passes on a reference to it */
+static void
+origin_add(const ucl_object_t *obj, uint16_t src, uint32_t line)
+{
+    origin_t *old = origins.slots;
+    size_t oldsize = origins.size, k, i;
+
+    if (origins.count * 2 >= origins.size) {
+	origins.size = oldsize == 0 ? 1024 : oldsize * 2;
+	origins.slots = calloc(origins.size, sizeof(origin_t));
+	if (origins.slots == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	    abort();
+	}
+	origins.count = 0;
+	for (k = 0; k < oldsize; k++) {
+	    if (old[k].obj != NULL) {
+		origin_add(old[k].obj, old[k].src, old[k].line);
+	    }
+	}
+	free(old);
+    }
+
+    i = origin_slot(obj, origins.size);
+    while (origins.slots[i].obj != NULL && origins.slots[i].obj != obj) {
+	i = (i + 1) & (origins.size - 1);
+    }
+    if (origins.slots[i].obj == NULL) {
+	origins.count++;
+    } else {
+	/* Already held */
+	ucl_object_unref(__DECONST(ucl_object_t *, obj));
+    }
+    origins.slots[i].obj = obj;
+    origins.slots[i].src = src;
+    origins.slots[i].line = line;
+}
+
+static void
+origin_free(void)
+{
+    size_t k;
+
+    for (k = 0; k < origins.size; k++) {
+	if (origins.slots[k].obj != NULL) {
+	    ucl_object_unref(__DECONST(ucl_object_t *, origins.slots[k].obj));
+	}
+    }
+    free(origins.slots);
+    memset(&origins, 0, sizeof(origins));
+}
+
+static const origin_t*
+origin_find(const ucl_object_t *obj)
+{
+    size_t i;
+
+    if (origins.size == 0) {
+	return NULL;
+    }
+    i = origin_slot(obj, origins.size);
+    while (origins.slots[i].obj != NULL) {
+	if (origins.slots[i].obj == obj) {
+	    return &origins.slots[i];
+	}
+	i = (i + 1) & (origins.size - 1);
+    }
+
+    return NULL;
+}
+
+static bool
+locate_keychar(char c)
+{
+
+    return isalnum((unsigned char)c) || c == '_' || c == '-';
+}
+
+/*
+ * Look for key at or after ctx->cur where it stands as a key: not inside a
+ * longer word, and followed (past any closing quote) by a space or by what
+ * can start a value.  On success ctx->line is the line it is on and ctx->cur
+ * is just past it.
+ */
+static bool
+locate_key(struct locate_ctx *ctx, const char *key, size_t keylen)
+{
+    const char *p, *after;
+    int match;
+
+    if (keylen == 0) {
+	return false;
+    }
+    for (p = ctx->cur; p + keylen <= ctx->end; p++) {
+	if (*p == '\n') {
+	    /* Pass over whole line comments */
+	    for (after = p + 1; after < ctx->end &&
+		(*after == ' ' || *after == '\t'); after++)
+		;
+	    if (after < ctx->end && (*after == '#' || (*after == '/' &&
+		    after + 1 < ctx->end && after[1] == '/'))) {
+		after = memchr(after, '\n', ctx->end - after);
+		if (after == NULL) {
+		    break;
+		}
+		p = after - 1;
+	    }
+	    continue;
+	}
+	if (ctx->fold) {
+	    match = strncasecmp(p, key, keylen) == 0;
+	} else {
+	    match = *p == *key && memcmp(p, key, keylen) == 0;
+	}
+	if (!match) {
+	    continue;
+	}
+	if (p > ctx->cur && (locate_keychar(p[-1]) || p[-1] == '.')) {
+	    continue;
+	}
+	after = p + keylen;
+	if (after < ctx->end && *after == '"') {
+	    after++;
+	}
+	if (after < ctx->end && *after != ' ' && *after != '\t' &&
+		*after != '\n' && *after != '=' && *after != ':' &&
+		*after != '{' && *after != '[') {
+	    continue;
+	}
+	while (ctx->cur < p) {
+	    if (*ctx->cur++ == '\n') {
+		ctx->line++;
+	    }
+	}
+	/* The next key, even one of the same name, comes after this one */
+	ctx->cur += keylen;
+	return true;
+    }
+
+    return false;
+}
+
+/* Record the origin of every member of obj, and of those below it */
+static void
+origin_locate(struct locate_ctx *ctx, const ucl_object_t *obj)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    const char *key;
+    size_t keylen;
+
+    while ((cur = ucl_object_iterate(obj, &it, false))) {
+	if (ucl_object_type(obj) == UCL_OBJECT) {
+	    key = ucl_object_keyl(cur, &keylen);
+	    origin_add(ucl_object_ref(cur), ctx->src, ctx->cur != NULL &&
+		locate_key(ctx, key, keylen) ? ctx->line : 0);
+	}
+	if (ucl_object_type(cur) == UCL_OBJECT ||
+		ucl_object_type(cur) == UCL_ARRAY) {
+	    origin_locate(ctx, cur);
+	}
+    }
+}
+
+/* Find the origins of the values of a fragment, src is its source id */
+static void
+origin_scan(const char *name, uint16_t src, const ucl_object_t *obj)
+{
+    struct locate_ctx ctx;
+    unsigned char *map = MAP_FAILED;
+    struct stat st;
+    int fd;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.src = src;
+    ctx.line = 1;
+    ctx.fold = (pflags & UCL_PARSER_KEY_LOWERCASE) != 0;
+
+    fd = open(name, O_RDONLY);
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0) {
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (fd != -1) {
+	close(fd);
+    }
+    if (map != MAP_FAILED && detect_input_format(map, st.st_size) !=
+	    UCL_PARSE_MSGPACK) {
+	(void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+	ctx.cur = (const char *)map;
+	ctx.end = ctx.cur + st.st_size;
+    }
+
+    origin_locate(&ctx, obj);
+
+    if (map != MAP_FAILED) {
+	munmap(map, st.st_size);
+    }
+}
+
+/* Attach a "# fragment:line" comment to every value of obj with an origin */
+static void
+origin_annotate(ucl_object_t *comments, const ucl_object_t *obj,
+    char **names)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    const origin_t *o;
+    char *note = NULL;
+
+    while ((cur = ucl_object_iterate(obj, &it, false))) {
+	o = origin_find(cur);
+	if (o != NULL && ucl_object_type(obj) == UCL_OBJECT) {
+	    if (o->line > 0) {
+		uclcmd_asprintf(&note, "# %s:%" PRIu32, names[o->src], o->line);
+	    } else {
+		uclcmd_asprintf(&note, "# %s", names[o->src]);
+	    }
+	    ucl_comments_add(comments, cur, note);
+	    free(note);
+	    note = NULL;
+	}
+	if (ucl_object_type(cur) == UCL_OBJECT ||
+		ucl_object_type(cur) == UCL_ARRAY) {
+	    origin_annotate(comments, cur, names);
+	}
+    }
+}
+
+int
+compile_main(int argc, char *argv[])
+{
+    filelist_t frags = { NULL, 0, 0 };
+    parse_job_t *jobs;
+    int ret = 0, ch, k, annotate = 0;
+
+    /* Set the default output type */
+    output_type = UCL_EMIT_CONFIG;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "annotate",	no_argument,		NULL,		'a' },
+	{ "canonical",	no_argument,		&canonical,	1 },
+	{ "cjson",	no_argument,		&output_type,
+	    UCL_EMIT_JSON_COMPACT },
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "delimiter",	required_argument,	NULL,		'D' },
+	{ "json",	no_argument,		&output_type,
+	    UCL_EMIT_JSON },
+	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
+	{ "msgpack",	no_argument,		&output_type,
+	    UCL_EMIT_MSGPACK },
+	{ "output",	required_argument,	NULL,		'o' },
+	{ "policy",	required_argument,	NULL,		'P' },
+	{ "ucl",	no_argument,		&output_type,
+	    UCL_EMIT_CONFIG },
+	{ "yaml",	no_argument,		&output_type,	UCL_EMIT_YAML },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "acdD:Ijmo:uy", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'a':
+	    annotate = 1;
+	    break;
+	case 'c':
+	    output_type = UCL_EMIT_JSON_COMPACT;
+	    break;
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'D':
+	    input_sepchar = optarg[0];
+	    output_sepchar = optarg[0];
+	    break;
+	case 'I':
+	    pflags |= UCL_PARSER_KEY_LOWERCASE;
+	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 'j':
+	    output_type = UCL_EMIT_JSON;
+	    break;
+	case 'm':
+	    output_type = UCL_EMIT_MSGPACK;
+	    break;
+	case 'o':
+	    outfile = optarg;
+	    output = output_open(outfile);
+	    break;
+	case 'P':
+	    merge_policy = string_to_policy(optarg);
+	    break;
+	case 'u':
+	    output_type = UCL_EMIT_CONFIG;
+	    break;
+	case 'y':
+	    output_type = UCL_EMIT_YAML;
+	    break;
+	case 0:
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc == 0) {
+	usage();
+    }
+    for (k = 0; k < argc; k++) {
+	filelist_add(&frags, argv[k]);
+    }
+    if (frags.count > ORIGIN_SRC_MAX) {
+	fprintf(stderr, "Error: At most %d fragments can be compiled\n",
+	    ORIGIN_SRC_MAX);
+	cleanup();
+	exit(1);
+    }
+
+    jobs = calloc(frags.count, sizeof(*jobs));
+    if (jobs == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (k = 0; k < frags.count; k++) {
+	jobs[k].name = frags.names[k];
+	jobs[k].flags = UCLCMD_PARSER_FLAGS | pflags;
+    }
+    parse_files(jobs, frags.count);
+
+    for (k = 0; k < frags.count; k++) {
+	if (ucl_object_type(jobs[k].obj) != UCL_OBJECT) {
+	    fprintf(stderr, "Error: Cannot compile %s, it is not an object\n",
+		jobs[k].name);
+	    ret = 1;
+	    goto out;
+	}
+	origin_scan(jobs[k].name, k, jobs[k].obj);
+	if (k == 0) {
+	    root_obj = ucl_object_ref(jobs[0].obj);
+	} else if (!merge_recursive(root_obj, jobs[k].obj, merge_policy)) {
+	    fprintf(stderr, "Error: Failed to merge %s\n", jobs[k].name);
+	    ret = 1;
+	    goto out;
+	}
+    }
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Compiled %d fragments, %zu origins in a "
+	    "%zu slot table\n", frags.count, origins.count, origins.size);
+    }
+
+    if (annotate && canonical) {
+	/* The comments would be attached to the tree, not its sorted copy */
+	fprintf(stderr, "WARN: --canonical output can not be annotated\n");
+    } else if (annotate) {
+	if (output_type != UCL_EMIT_CONFIG) {
+	    fprintf(stderr, "WARN: Only UCL output can be annotated\n");
+	}
+	annotations = ucl_object_typed_new(UCL_OBJECT);
+	origin_annotate(annotations, root_obj, frags.names);
+    }
+    get_mode("");
+
+out:
+    for (k = 0; k < frags.count; k++) {
+	if (jobs[k].obj != NULL) {
+	    ucl_object_unref(jobs[k].obj);
+	}
+    }
+    free(jobs);
+    cleanup();
+    origin_free();
+    filelist_free(&frags);
+
+    return(ret);
+}
@@ -0,0 +1,528 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Structural diff
+ *
+ * uclcmd diff a b hashes every subtree of both trees bottom-up, once, into
+ * a 64 bit value that stands for its contents: the hash of an object does
+ * not depend on the order of its keys, that of an array does.  Walking the
+ * two trees together, a pair of subtrees with the same hash is passed over
+ * without looking inside, so the cost of a diff is in the parts that differ.
+ *
+ * The hashes of containers are kept in a table keyed on the object's
+ * address; those of scalars are cheap enough to work out again.  The top
+ * level keys of both trees are hashed in parallel, each thread filling a
+ * table of its own that is folded into one when they are done.
+ *
+ * Paths are reported as output_key() writes them, behind a marker:
+ *   +path=value	only in b
+ *   -path=value	only in a
+ *   ~path=value	in both, value is the one from b
+ */
+
+#include "uclcmd.h"
+
+#define HASH_OBJECT	0x6f626a6563740aULL
+#define HASH_ARRAY	0x61727261790aULL
+
+struct hashmemo {
+	struct hashmemo_slot {
+		const ucl_object_t	*obj;	/* NULL for a free slot */
+		uint64_t		hash;
+	}		*slots;
+	size_t		size;		/* a power of 2 */
+	size_t		count;
+};
+
+/* Top level subtrees, handed out to the hashing threads */
+struct hash_pool {
+	pthread_mutex_t		lock;
+	const ucl_object_t	**objs;
+	int			nobjs;
+	int			next;		/* first one not taken yet */
+};
+
+static inline uint64_t
+hash_mix(uint64_t h)
+{
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+
+    return h;
+}
+
+static size_t
+hashmemo_slot(const ucl_object_t *obj, size_t size)
+{
+
+    return hash_mix((uintptr_t)obj) & (size - 1);
+}
+
+static void
+hashmemo_add(struct hashmemo *memo, const ucl_object_t *obj, uint64_t hash)
+{
+    struct hashmemo_slot *old = memo->slots;
+    size_t oldsize = memo->size, k, i;
+
+    if (memo->count * 2 >= memo->size) {
+	memo->size = oldsize == 0 ? 1024 : oldsize * 2;
+	memo->slots = calloc(memo->size, sizeof(*memo->slots));
+	if (memo->slots == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	    abort();
+	}
+	memo->count = 0;
+	for (k = 0; k < oldsize; k++) {
+	    if (old[k].obj != NULL) {
+		hashmemo_add(memo, old[k].obj, old[k].hash);
+	    }
+	}
+	free(old);
+    }
+
+    i = hashmemo_slot(obj, memo->size);
+    while (memo->slots[i].obj != NULL && memo->slots[i].obj != obj) {
+	i = (i + 1) & (memo->size - 1);
+    }
+    if (memo->slots[i].obj == NULL) {
+	memo->count++;
+    }
+    memo->slots[i].obj = obj;
+    memo->slots[i].hash = hash;
+}
+
+static bool
+hashmemo_find(const struct hashmemo *memo, const ucl_object_t *obj,
+    uint64_t *hash)
+{
+    size_t i;
+
+    if (memo == NULL || memo->size == 0) {
+	return false;
+    }
+    i = hashmemo_slot(obj, memo->size);
+    while (memo->slots[i].obj != NULL) {
+	if (memo->slots[i].obj == obj) {
+	    *hash = memo->slots[i].hash;
+	    return true;
+	}
+	i = (i + 1) & (memo->size - 1);
+    }
+
+    return false;
+}
+
+static void
+hashmemo_free(struct hashmemo *memo)
+{
+
+    free(memo->slots);
+    memset(memo, 0, sizeof(*memo));
+}
+
+/*
+ * The hash of obj and everything below it.  With a memo, the hashes of
+ * containers are looked up there first and stored there once worked out.
+ * With canon, floats are hashed as they are output in canonical form and
+ * a time as the float it is.
+ */
+static uint64_t
+hash_walk(const ucl_object_t *obj, struct hashmemo *memo, bool canon)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    const char *str;
+    size_t len;
+    uint64_t h, k;
+    int64_t ival;
+    double dval;
+
+    if (obj == NULL) {
+	return hash_mix(UCL_NULL);
+    }
+    switch (ucl_object_type(obj)) {
+    case UCL_OBJECT:
+	if (hashmemo_find(memo, obj, &h)) {
+	    return h;
+	}
+	/* A sum of the members, so that key order does not matter */
+	h = HASH_OBJECT;
+	while ((cur = ucl_object_iterate(obj, &it, false))) {
+	    str = ucl_object_keyl(cur, &len);
+	    k = hash_buffer(str, len);
+	    h += hash_mix(k ^
+		(hash_walk(cur, memo, canon) * 0x9e3779b97f4a7c15ULL));
+	}
+	h = hash_mix(h);
+	break;
+    case UCL_ARRAY:
+	if (hashmemo_find(memo, obj, &h)) {
+	    return h;
+	}
+	h = HASH_ARRAY ^ obj->len;
+	while ((cur = ucl_object_iterate(obj, &it, true))) {
+	    h = hash_mix(h ^ hash_walk(cur, memo, canon));
+	}
+	break;
+    case UCL_STRING:
+	str = ucl_object_tolstring(obj, &len);
+	return hash_mix(hash_buffer(str, len) ^ UCL_STRING);
+    case UCL_INT:
+	ival = ucl_object_toint(obj);
+	return hash_mix((uint64_t)ival ^ ((uint64_t)UCL_INT << 56));
+    case UCL_FLOAT:
+    case UCL_TIME:
+	dval = ucl_object_todouble(obj);
+	if (canon) {
+	    dval = canonical_double(dval);
+	}
+	memcpy(&h, &dval, sizeof(h));
+	return hash_mix(h ^ ((uint64_t)(canon ? UCL_FLOAT :
+	    ucl_object_type(obj)) << 56));
+    case UCL_BOOLEAN:
+	return hash_mix(ucl_object_toboolean(obj) ^
+	    ((uint64_t)UCL_BOOLEAN << 56));
+    default:
+	return hash_mix(ucl_object_type(obj));
+    }
+    if (memo != NULL) {
+	hashmemo_add(memo, obj, h);
+    }
+
+    return h;
+}
+
+uint64_t
+hash_object(const ucl_object_t *obj, struct hashmemo *memo)
+{
+
+    return hash_walk(obj, memo, false);
+}
+
+/* The hash of obj for get fingerprint, the same for -0.0 and 0.0 */
+uint64_t
+hash_canonical(const ucl_object_t *obj)
+{
+
+    return hash_walk(obj, NULL, true);
+}
+
+static void*
+hash_worker(void *arg)
+{
+    struct hash_pool *pool = arg;
+    struct hashmemo *memo;
+    const ucl_object_t *obj;
+
+    memo = calloc(1, sizeof(*memo));
+    if (memo == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	obj = pool->next < pool->nobjs ? pool->objs[pool->next++] : NULL;
+	pthread_mutex_unlock(&pool->lock);
+	if (obj == NULL) {
+	    break;
+	}
+	hash_object(obj, memo);
+    }
+
+    return memo;
+}
+
+/*
+ * Hash every subtree of a and b into memo, the top level keys of both
+ * spread over as many threads as there are CPUs
+ */
+static void
+hash_trees(const ucl_object_t *a, const ucl_object_t *b, struct hashmemo *memo)
+{
+    struct hash_pool pool;
+    struct hashmemo *part;
+    const ucl_object_t *roots[2] = { a, b }, *cur;
+    ucl_object_iter_t it;
+    pthread_t *threads;
+    size_t i, cap = 0;
+    long ncpu;
+    int nthreads, k, r;
+
+    memset(&pool, 0, sizeof(pool));
+    for (r = 0; r < 2; r++) {
+	if (ucl_object_type(roots[r]) == UCL_OBJECT ||
+		ucl_object_type(roots[r]) == UCL_ARRAY) {
+	    cap += roots[r]->len;
+	}
+    }
+    pool.objs = calloc(cap + 1, sizeof(*pool.objs));
+    if (pool.objs == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (r = 0; r < 2; r++) {
+	if (ucl_object_type(roots[r]) != UCL_OBJECT &&
+		ucl_object_type(roots[r]) != UCL_ARRAY) {
+	    continue;
+	}
+	it = NULL;
+	while ((cur = ucl_object_iterate(roots[r], &it, false)) &&
+		(size_t)pool.nobjs < cap) {
+	    if (ucl_object_type(cur) == UCL_OBJECT ||
+		    ucl_object_type(cur) == UCL_ARRAY) {
+		pool.objs[pool.nobjs++] = cur;
+	    }
+	}
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu < 1 ? 1 : (ncpu < pool.nobjs ? ncpu : pool.nobjs);
+    threads = calloc(nthreads > 0 ? nthreads : 1, sizeof(*threads));
+    if (threads == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (k = 0; k < nthreads; k++) {
+	if (pthread_create(&threads[k], NULL, hash_worker, &pool) != 0) {
+	    /* Carry on with the threads we have */
+	    break;
+	}
+    }
+    nthreads = k;
+    if (nthreads == 0) {
+	part = hash_worker(&pool);
+	hashmemo_free(memo);
+	*memo = *part;
+	free(part);
+    }
+    for (k = 0; k < nthreads; k++) {
+	pthread_join(threads[k], (void **)&part);
+	for (i = 0; i < part->size; i++) {
+	    if (part->slots[i].obj != NULL) {
+		hashmemo_add(memo, part->slots[i].obj, part->slots[i].hash);
+	    }
+	}
+	hashmemo_free(part);
+	free(part);
+    }
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.objs);
+
+    /* The roots themselves, from the hashes of their members */
+    hash_object(a, memo);
+    hash_object(b, memo);
+
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Hashed %zu containers on %d threads\n",
+	    memo->count, nthreads < 1 ? 1 : nthreads);
+    }
+}
+
+static void
+diff_report(char marker, const ucl_object_t *obj, const nodepath_t *path)
+{
+
+    if (firstline == false) {
+	output_char(' ');
+	firstline = true;
+    }
+    output_char(marker);
+    output_key(obj, path);
+}
+
+/* Report the differences between a and b, both at path */
+static int
+diff_walk(const ucl_object_t *a, const ucl_object_t *b, nodepath_t *path,
+    struct hashmemo *memo)
+{
+    const ucl_object_t *cur, *other;
+    ucl_object_iter_t it = NULL;
+    const char *key;
+    size_t keylen, mark;
+    unsigned int idx;
+    int sep = path->len > 0 ? output_sepchar : 0, changes = 0;
+
+    if (hash_object(a, memo) == hash_object(b, memo)) {
+	return 0;
+    }
+
+    if (ucl_object_type(a) == UCL_OBJECT && ucl_object_type(b) == UCL_OBJECT) {
+	while ((cur = ucl_object_iterate(a, &it, false))) {
+	    key = ucl_object_keyl(cur, &keylen);
+	    mark = nodepath_push(path, key, keylen, sep);
+	    other = ucl_object_lookup_len(b, key, keylen);
+	    if (other == NULL) {
+		diff_report('-', cur, path);
+		changes++;
+	    } else {
+		changes += diff_walk(cur, other, path, memo);
+	    }
+	    nodepath_pop(path, mark);
+	}
+	it = NULL;
+	while ((cur = ucl_object_iterate(b, &it, false))) {
+	    key = ucl_object_keyl(cur, &keylen);
+	    if (ucl_object_lookup_len(a, key, keylen) == NULL) {
+		mark = nodepath_push(path, key, keylen, sep);
+		diff_report('+', cur, path);
+		nodepath_pop(path, mark);
+		changes++;
+	    }
+	}
+    } else if (ucl_object_type(a) == UCL_ARRAY &&
+	    ucl_object_type(b) == UCL_ARRAY) {
+	for (idx = 0; idx < a->len || idx < b->len; idx++) {
+	    mark = nodepath_push_index(path, idx, sep);
+	    cur = ucl_array_find_index(a, idx);
+	    other = ucl_array_find_index(b, idx);
+	    if (other == NULL) {
+		diff_report('-', cur, path);
+		changes++;
+	    } else if (cur == NULL) {
+		diff_report('+', other, path);
+		changes++;
+	    } else {
+		changes += diff_walk(cur, other, path, memo);
+	    }
+	    nodepath_pop(path, mark);
+	}
+    } else {
+	diff_report('~', b, path);
+	changes++;
+    }
+
+    return changes;
+}
+
+int
+diff_main(int argc, char *argv[])
+{
+    struct hashmemo memo;
+    parse_job_t jobs[2];
+    nodepath_t path;
+    int ch, k, changes, exitcode = 0;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "delimiter",	required_argument,	NULL,		'D' },
+	{ "exit-code",	no_argument,		NULL,		'x' },
+	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
+	{ "nonewline",	no_argument,		&nonewline,	1 },
+	{ "noquotes",	no_argument,		&show_raw,	1 },
+	{ "output",	required_argument,	NULL,		'o' },
+	{ "shellvars",	no_argument,		NULL,		'l' },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "dD:IlNo:qx", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'D':
+	    input_sepchar = optarg[0];
+	    output_sepchar = optarg[0];
+	    break;
+	case 'I':
+	    pflags |= UCL_PARSER_KEY_LOWERCASE;
+	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 'l':
+	    shvars = true;
+	    output_sepchar = '_';
+	    break;
+	case 'N':
+	    nonewline = 1;
+	    break;
+	case 'o':
+	    outfile = optarg;
+	    output = output_open(outfile);
+	    break;
+	case 'q':
+	    show_raw = 1;
+	    break;
+	case 'x':
+	    exitcode = 1;
+	    break;
+	case 0:
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 2) {
+	usage();
+    }
+
+    /* Both parsed at once, each with a parser of its own */
+    memset(jobs, 0, sizeof(jobs));
+    for (k = 0; k < 2; k++) {
+	jobs[k].name = strcmp(argv[k], "-") == 0 ? "/dev/stdin" : argv[k];
+	jobs[k].flags = UCLCMD_PARSER_FLAGS | pflags;
+    }
+    parse_files(jobs, 2);
+    root_obj = jobs[0].obj;
+    set_obj = jobs[1].obj;
+
+    memset(&memo, 0, sizeof(memo));
+    hash_trees(root_obj, set_obj, &memo);
+
+    show_keys = 1;
+    nodepath_init(&path, "");
+    changes = diff_walk(root_obj, set_obj, &path, &memo);
+    nodepath_free(&path);
+    hashmemo_free(&memo);
+
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: %d paths differ\n", changes);
+    }
+    cleanup();
+
+    return (exitcode && changes > 0) ? 1 : 0;
+}
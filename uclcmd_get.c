@@ -28,13 +28,65 @@
 
 #include "uclcmd.h"
 
+/* One requested path and the commands to run on it */
+typedef struct get_query {
+	char		*node_name;	/* path, leading separator removed */
+	get_prog_t	*prog;		/* commands after the first '|' */
+	path_trie_t	*node;		/* NULL if the path can never match */
+} get_query_t;
+
+typedef struct get_plan {
+	get_query_t	*queries;
+	int		nqueries;
+	path_trie_t	*trie;
+	nodepath_t	path;
+} get_plan_t;
+
+static const struct {
+	const char	*name;
+	enum get_op	op;
+} get_ops[] = {
+	{ "length",	GET_OP_LENGTH },
+	{ "dump",	GET_OP_DUMP },
+	{ "type",	GET_OP_TYPE },
+	{ "keys",	GET_OP_KEYS },
+	{ "values",	GET_OP_VALUES },
+	{ "iterate",	GET_OP_ITERATE },
+	{ "recurse",	GET_OP_RECURSE },
+	{ "each",	GET_OP_EACH },
+	{ "fingerprint", GET_OP_FINGERPRINT },
+	{ NULL,		GET_OP_END }
+};
+
+/* Used for --shellvars output when no commands were given */
+static get_insn_t recurse_insns[] = {
+	{ GET_OP_RECURSE,	"recurse",	NULL,	0 },
+	{ GET_OP_END,		NULL,		NULL,	0 }
+};
+static const get_prog_t recurse_prog = { recurse_insns, 1, NULL };
+
+/* Set when the value for get_mode() came from the sidecar index */
+static const ucl_object_t *indexed_obj = NULL;
+
+static void get_compile_paths(get_insn_t *insn);
+static void get_plan_free(get_plan_t *plan);
+static get_plan_t* get_plan_new(int argc, char *argv[]);
+static void get_plan_output(get_plan_t *plan);
+static void get_plan_run(const ucl_object_t *root, void *ud);
+static void get_run(const ucl_object_t *found_object, nodepath_t *path,
+    const get_prog_t *prog);
+
 int
 get_main(int argc, char *argv[])
 {
-    int ret = 0, k = 0, ch;
+    int ret = 0, ch, fd = STDIN_FILENO;
+    bool scan = false, stream = false;
+    get_plan_t *plan = NULL;
 
     /*	options	descriptor */
     static struct option longopts[] = {
+	{ "cache-dir",	required_argument,	NULL,		'C' },
+	{ "canonical",	no_argument,		&canonical,	1 },
 	{ "cjson",	no_argument,		&output_type,
 	    UCL_EMIT_JSON_COMPACT },
 	{ "debug",	optional_argument,	NULL,		'd' },
@@ -46,13 +98,19 @@ get_main(int argc, char *argv[])
 	{ "keys",	no_argument,		&show_keys,	1 },
 	{ "input",	no_argument,		NULL,		'i' },
 	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "framed",	no_argument,		&framed,	1 },
+	{ "input-format", required_argument,	NULL,		'F' },
 	{ "msgpack",	no_argument,		&output_type,
 	    UCL_EMIT_MSGPACK },
+	{ "ndjson",	no_argument,		&output_type,
+	    UCLCMD_EMIT_NDJSON },
 	{ "noop",	no_argument,		&noop,		1 },
 	{ "nonewline",	no_argument,		&nonewline,	1 },
 	{ "noquotes",	no_argument,		&show_raw,	1 },
 	{ "output",	required_argument,	NULL,		'o' },
+	{ "scan",	no_argument,		NULL,		'X' },
 	{ "shellvars",	no_argument,		NULL,		'l' },
+	{ "stream",	no_argument,		NULL,		'S' },
 	{ "ucl",	no_argument,		&output_type,
 	    UCL_EMIT_CONFIG },
 	{ "yaml",	no_argument,		&output_type,	UCL_EMIT_YAML },
@@ -61,6 +119,9 @@ get_main(int argc, char *argv[])
 
     while ((ch = getopt_long(argc, argv, "cdD:ef:i:IjklmnNo:quy", longopts, NULL)) != -1) {
 	switch (ch) {
+	case 'C':
+	    cache_dir = optarg;
+	    break;
 	case 'c':
 	    output_type = UCL_EMIT_JSON_COMPACT;
 	    break;
@@ -88,6 +149,9 @@ get_main(int argc, char *argv[])
 	case 'I':
 	    pflags |= UCL_PARSER_KEY_LOWERCASE;
 	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
 	case 'j':
 	    output_type = UCL_EMIT_JSON;
 	    break;
@@ -114,6 +178,12 @@ get_main(int argc, char *argv[])
 	case 'q':
 	    show_raw = 1;
 	    break;
+	case 'S':
+	    stream = true;
+	    break;
+	case 'X':
+	    scan = true;
+	    break;
 	case 'u':
 	    output_type = UCL_EMIT_CONFIG;
 	    break;
@@ -135,18 +205,75 @@ get_main(int argc, char *argv[])
 	usage();
     }
 
+    if (stream) {
+	/* Run the same plan on every record of the input */
+	if (filename != NULL && strcmp(filename, "-") != 0) {
+	    fd = open(filename, O_RDONLY);
+	    if (fd < 0) {
+		fprintf(stderr, "Error: Failed to open %s: %s\n", filename,
+		    strerror(errno));
+		cleanup();
+		exit(2);
+	    }
+	}
+	plan = get_plan_new(argc, argv);
+	if (parse_stream(fd, get_plan_run, plan) > 0) {
+	    ret = 1;
+	}
+	get_plan_free(plan);
+	if (fd != STDIN_FILENO) {
+	    close(fd);
+	}
+	cleanup();
+	return(ret);
+    }
+
     /* Initialize parser */
     parser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
 
-    if (filename == NULL || strcmp(filename, "-") == 0) {
+    if (filename != NULL && strcmp(filename, "-") != 0 && argc == 1 &&
+	!scan && input_format != UCL_PARSE_MSGPACK &&
+	(pflags & UCL_PARSER_KEY_LOWERCASE) == 0) {
+	indexed_obj = index_lookup(filename, argv[0]);
+    }
+
+    if (indexed_obj == NULL &&
+	(scan || (filename != NULL && strcmp(filename, "-") != 0))) {
+	/* Only pull the requested values out of msgpack, or JSON with --scan */
+	plan = get_plan_new(argc, argv);
+	if (scan_file(filename, plan->trie, scan)) {
+	    get_plan_output(plan);
+	    get_plan_free(plan);
+	    cleanup();
+	    return(ret);
+	}
+    }
+
+    if (indexed_obj != NULL) {
+	/* root_obj only holds the value from the index */
+    } else if (filename == NULL || strcmp(filename, "-") == 0) {
 	/* Input from STDIN */
 	root_obj = parse_input(parser, stdin);
     } else {
-	root_obj = parse_file(parser, filename);
+	if (cache_dir != NULL) {
+	    root_obj = cache_load(filename);
+	}
+	if (root_obj == NULL) {
+	    root_obj = parse_file(parser, filename);
+	    if (cache_dir != NULL) {
+		cache_store(root_obj);
+	    }
+	}
     }
 
-    for (k = 0; k < argc; k++) {
-	get_mode(argv[k]);
+    if (plan == NULL && argc == 1) {
+	get_mode(argv[0]);
+    } else {
+	if (plan == NULL) {
+	    plan = get_plan_new(argc, argv);
+	}
+	get_plan_run(root_obj, plan);
+	get_plan_free(plan);
     }
 
     cleanup();
@@ -160,11 +287,11 @@ get_mode(char *requested_node)
     const ucl_object_t *found_object;
     char *cmd = requested_node;
     char *node_name = strsep(&cmd, "|");
-    char *command_str = strsep(&cmd, "|");
-    char *nodepath = NULL;
-    int command_count = 0, i = 0;
+    nodepath_t path;
+    get_prog_t *prog;
 
-    uclcmd_asprintf(&nodepath, "");
+    prog = get_compile(cmd);
+    nodepath_init(&path, "");
     found_object = root_obj;
 
     if (strlen(node_name) == 0) {
@@ -187,31 +314,137 @@ get_mode(char *requested_node)
 	if (debug > 0) {
 	    fprintf(stderr, "DEBUG: Searching node %s\n", node_name);
 	}
-	found_object = ucl_lookup_path_char(found_object, node_name, input_sepchar);
-	free(nodepath);
-	uclcmd_asprintf(&nodepath, "%s", node_name);
+	if (indexed_obj != NULL) {
+	    found_object = indexed_obj;
+	} else {
+	    found_object = ucl_lookup_path_char(found_object, node_name,
+		input_sepchar);
+	}
+	nodepath_push(&path, node_name, strlen(node_name), 0);
+    }
+
+    get_run(found_object, &path, prog);
+    nodepath_free(&path);
+    get_prog_free(prog);
+}
+
+/*
+ * Several requested paths are resolved in a single walk of the tree: the
+ * paths are merged into a prefix trie so that each shared prefix is looked
+ * up once, then every request is output in the order it was given.  The
+ * plan is built once and can be run on any number of trees.
+ */
+static get_plan_t*
+get_plan_new(int argc, char *argv[])
+{
+    get_plan_t *plan;
+    char *cmd, *node_name;
+    int k;
+
+    plan = calloc(1, sizeof(*plan));
+    if (plan != NULL) {
+	plan->queries = calloc(argc, sizeof(*plan->queries));
+    }
+    if (plan == NULL || plan->queries == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    plan->nqueries = argc;
+    plan->trie = trie_new();
+    nodepath_init(&plan->path, "");
+
+    for (k = 0; k < argc; k++) {
+	cmd = argv[k];
+	node_name = strsep(&cmd, "|");
+	if (node_name[0] == input_sepchar) {
+	    /* Removing leading dot */
+	    node_name++;
+	}
+	plan->queries[k].node_name = node_name;
+	plan->queries[k].prog = get_compile(cmd);
+	plan->queries[k].node = trie_insert(plan->trie, node_name);
+	if (node_name[0] != '\0' && plan->queries[k].node == plan->trie) {
+	    /* Only separators, ucl_lookup_path_char() finds nothing */
+	    plan->queries[k].node = NULL;
+	}
+    }
+
+    return plan;
+}
+
+static void
+get_plan_run(const ucl_object_t *root, void *ud)
+{
+    get_plan_t *plan = ud;
+
+    trie_resolve(plan->trie, root);
+    get_plan_output(plan);
+}
+
+/*
+ * Run each query on the object its trie node was resolved to
+ */
+static void
+get_plan_output(get_plan_t *plan)
+{
+    get_query_t *query;
+    const ucl_object_t *found_object;
+    int k;
+
+    for (k = 0; k < plan->nqueries; k++) {
+	query = &plan->queries[k];
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Searching node %s\n", query->node_name);
+	}
+	found_object = NULL;
+	if (query->node != NULL) {
+	    found_object = query->node->obj;
+	}
+	nodepath_push(&plan->path, query->node_name,
+	    strlen(query->node_name), 0);
+	get_run(found_object, &plan->path, query->prog);
+	nodepath_pop(&plan->path, 0);
+    }
+}
+
+static void
+get_plan_free(get_plan_t *plan)
+{
+    int k;
+
+    for (k = 0; k < plan->nqueries; k++) {
+	get_prog_free(plan->queries[k].prog);
     }
+    nodepath_free(&plan->path);
+    trie_free(plan->trie);
+    free(plan->queries);
+    free(plan);
+}
 
-    while (command_str != NULL) {
+/*
+ * Run the compiled commands on found_object, or output it if there are none
+ */
+static void
+get_run(const ucl_object_t *found_object, nodepath_t *path,
+    const get_prog_t *prog)
+{
+    int command_count = 0, done = 0, pc = 0;
+
+    while (pc < prog->len) {
 	if (debug > 0) {
 	    fprintf(stderr, "DEBUG: Performing \"%s\" command on \"%s\"...\n",
-		command_str, node_name);
+		prog->insns[pc].name, path->buf);
 	}
-	int done = process_get_command(found_object, nodepath, command_str,
-	    cmd, 1);
+	done = process_get_command(found_object, path, prog, pc, 1);
 	if (debug >= 2) {
 	    fprintf(stderr, "DEBUG: Finished process, did: %i commands\n",
 		done);
 	}
-
-	for (i = 0; i < done; i++) {
-	    if (debug >= 2) {
-		fprintf(stderr, "DEBUG: Removing command: %s\n", command_str);
-	    }
-	    command_str = strsep(&cmd, "|");
-	}
-	if (debug >= 2) {
-	    fprintf(stderr, "DEBUG: Remaining command: %s\n", command_str);
+	/* Commands run on each element were consumed along the way */
+	pc += done;
+	if (debug >= 2 && pc < prog->len) {
+	    fprintf(stderr, "DEBUG: Remaining command: %s\n",
+		prog->insns[pc].name);
 	}
 	command_count += done;
     }
@@ -222,59 +455,232 @@ get_mode(char *requested_node)
     }
     if (command_count == 0) {
 	if (shvars == 1) {
-		get_cmd_recurse(found_object, "", "recurse", "", 0);
+		nodepath_t root;
+
+		nodepath_init(&root, "");
+		get_cmd_recurse(found_object, &root, &recurse_prog, 0, 0);
+		nodepath_free(&root);
 	} else {
-		output_chunk(found_object, nodepath, "");
+		output_chunk(found_object, path, path->len);
 	}
     }
-    free(nodepath);
+}
+
+/*
+ * Split one "|" separated command into the paths it looks up, each already
+ * broken into segments, so nothing is parsed while walking the tree
+ */
+static void
+get_compile_paths(get_insn_t *insn)
+{
+    get_path_t *path;
+    const char *p;
+    char *list, *reqnode, *seg, *end;
+    char *reqnodelist;
+    int count = 1;
+
+    for (p = insn->name; *p != '\0'; p++) {
+	if (*p == ' ')
+	    count++;
+    }
+    insn->paths = calloc(count, sizeof(*insn->paths));
+    reqnodelist = list = strdup(insn->name);
+    if (insn->paths == NULL || list == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    while ((reqnode = strsep(&list, " ")) != NULL) {
+	path = &insn->paths[insn->npaths++];
+	path->text = strdup(reqnode);
+	count = 1;
+	for (seg = reqnode; *seg != '\0'; seg++) {
+	    if (*seg == input_sepchar)
+		count++;
+	}
+	path->segs = calloc(count, sizeof(*path->segs));
+	if (path->text == NULL || path->segs == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		ENOMEM);
+	    abort();
+	}
+	/* Empty segments are skipped, as ucl_lookup_path_char() does */
+	seg = reqnode;
+	while (*seg != '\0') {
+	    end = strchr(seg, input_sepchar);
+	    if (end == NULL) {
+		end = seg + strlen(seg);
+	    }
+	    if (end > seg) {
+		path->segs[path->nsegs].name = strndup(seg, end - seg);
+		path->segs[path->nsegs].len = end - seg;
+		path->nsegs++;
+	    }
+	    if (*end == '\0') {
+		break;
+	    }
+	    seg = end + 1;
+	}
+    }
+    free(reqnodelist);
+}
+
+/*
+ * Compile the '|' separated commands that follow a path into a program.
+ * Unknown commands are rejected here, before any output is produced.
+ */
+get_prog_t*
+get_compile(const char *commands)
+{
+    get_prog_t *prog;
+    get_insn_t *insn;
+    char *cmd, *command_str;
+    int count = 0, i;
+
+    prog = calloc(1, sizeof(*prog));
+    if (prog == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    if (commands != NULL) {
+	prog->buf = strdup(commands);
+	count = 1;
+	for (i = 0; commands[i] != '\0'; i++) {
+	    if (commands[i] == '|')
+		count++;
+	}
+    }
+    /* One more for the GET_OP_END terminator */
+    prog->insns = calloc(count + 1, sizeof(*prog->insns));
+    if (prog->insns == NULL || (commands != NULL && prog->buf == NULL)) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    cmd = prog->buf;
+    while ((command_str = strsep(&cmd, "|")) != NULL) {
+	insn = &prog->insns[prog->len++];
+	insn->name = command_str;
+	for (i = 0; get_ops[i].name != NULL; i++) {
+	    if (strcmp(command_str, get_ops[i].name) == 0) {
+		insn->op = get_ops[i].op;
+		break;
+	    }
+	}
+	if (get_ops[i].name != NULL) {
+	    continue;
+	}
+	if (command_str[0] == input_sepchar) {
+	    insn->op = GET_OP_NONE;
+	    get_compile_paths(insn);
+	} else {
+	    /* Not a valid command */
+	    fprintf(stderr, "Error: invalid command %s\n", command_str);
+	    exit(1);
+	}
+    }
+
+    return prog;
+}
+
+void
+get_prog_free(get_prog_t *prog)
+{
+    get_insn_t *insn;
+    int i, j, k;
+
+    if (prog == NULL) {
+	return;
+    }
+    for (i = 0; i < prog->len; i++) {
+	insn = &prog->insns[i];
+	for (j = 0; j < insn->npaths; j++) {
+	    for (k = 0; k < insn->paths[j].nsegs; k++) {
+		free(insn->paths[j].segs[k].name);
+	    }
+	    free(insn->paths[j].segs);
+	    free(insn->paths[j].text);
+	}
+	free(insn->paths);
+    }
+    free(prog->insns);
+    free(prog->buf);
+    free(prog);
+}
+
+/*
+ * Look up a compiled path below obj, as ucl_lookup_path_char() would
+ */
+const ucl_object_t*
+get_path_lookup(const ucl_object_t *obj, const get_path_t *path)
+{
+    int i;
+
+    if (path->nsegs == 0) {
+	return NULL;
+    }
+    for (i = 0; i < path->nsegs && obj != NULL; i++) {
+	obj = lookup_segment(obj, path->segs[i].name, path->segs[i].len);
+    }
+
+    return obj;
 }
 
 int
-process_get_command(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+process_get_command(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
-    int command_count = 0, recurse_level = recurse;
+    const get_insn_t *insn = &prog->insns[pc];
+    int recurse_level = recurse;
 
     if (debug >= 2) {
 	fprintf(stderr, "DEBUG: Got command: %s - next command: %s\n",
-	    command_str, remaining_commands);
+	    insn->name, prog->insns[pc + 1].op == GET_OP_END ? "(none)" :
+	    prog->insns[pc + 1].name);
     }
-    if (strcmp(command_str, "length") == 0) {
-	recurse_level = get_cmd_length(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "dump") == 0) {
+    switch (insn->op) {
+    case GET_OP_LENGTH:
+	recurse_level = get_cmd_length(obj, path, prog, pc,
+		recurse_level);
+	break;
+    case GET_OP_DUMP:
 	ucl_obj_dump(obj,2);
-    } else if (strcmp(command_str, "type") == 0) {
-	recurse_level = get_cmd_type(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "keys") == 0) {
-	recurse_level = get_cmd_keys(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "values") == 0) {
-	recurse_level = get_cmd_values(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "iterate") == 0) {
-	recurse_level = get_cmd_iterate(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "recurse") == 0) {
-	recurse_level = get_cmd_recurse(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (strcmp(command_str, "each") == 0) {
-	recurse_level = get_cmd_each(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else if (command_str[0] == input_sepchar) {
-	recurse_level = get_cmd_none(obj, nodepath, command_str,
-		remaining_commands, recurse_level);
-    } else {
-	/* Not a valid command */
-	fprintf(stderr, "Error: invalid command %s\n", command_str);
-	exit(1);
+	break;
+    case GET_OP_TYPE:
+	recurse_level = get_cmd_type(obj, path, prog, pc, recurse_level);
+	break;
+    case GET_OP_KEYS:
+	recurse_level = get_cmd_keys(obj, path, prog, pc, recurse_level);
+	break;
+    case GET_OP_VALUES:
+	recurse_level = get_cmd_values(obj, path, prog, pc,
+		recurse_level);
+	break;
+    case GET_OP_ITERATE:
+	recurse_level = get_cmd_iterate(obj, path, prog, pc,
+		recurse_level);
+	break;
+    case GET_OP_RECURSE:
+	recurse_level = get_cmd_recurse(obj, path, prog, pc,
+		recurse_level);
+	break;
+    case GET_OP_EACH:
+	recurse_level = get_cmd_each(obj, path, prog, pc, recurse_level);
+	break;
+    case GET_OP_FINGERPRINT:
+	recurse_level = get_cmd_fingerprint(obj, path, prog, pc,
+		recurse_level);
+	break;
+    case GET_OP_NONE:
+	recurse_level = get_cmd_none(obj, path, prog, pc, recurse_level);
+	break;
+    case GET_OP_END:
+	/* get_compile() rejects anything else */
+	break;
     }
-    command_count++;
     if (debug >= 3) {
-	fprintf(stderr, "DEBUG: Returning p_g_c with c_count=%i rlevel=%i\n",
-	    command_count, recurse_level);
+	fprintf(stderr, "DEBUG: Returning p_g_c with c_count=1 rlevel=%i\n",
+	    recurse_level);
     }
     return recurse_level;
 }
@@ -283,25 +689,66 @@ process_get_command(const ucl_object_t *obj, char *nodepath,
  * Return the number of keys in an object or items in an array
  */
 int
-get_cmd_length(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_length(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
     if (firstline == false) {
-	fprintf(output, " ");
+	output_char(' ');
     }
     if (obj == NULL) {
 	if (show_keys == 1)
-	    fprintf(output, "(null)=");
-	fprintf(output, "0");
+	    output_str("(null)=");
+	output_str("0");
     } else {
 	if (show_keys == 1)
-	    fprintf(output, "%s", nodepath);
-	fprintf(output, "%u", obj->len);
+	    output_path(path, 0);
+	output_int(obj->len);
     }
     if (nonewline) {
 	firstline = false;
     } else {
-	fprintf(output, "\n");
+	output_char('\n');
+    }
+
+    return recurse;
+}
+
+/*
+ * Return a hash of the current object and everything below it, straight
+ * from the tree rather than from its emitted text.  The order of keys makes
+ * no difference, so equal configs have equal fingerprints however they
+ * were written.  Numbers are hashed as --canonical outputs them.  It tells changes apart, it is not a cryptographic hash.
+ */
+int
+get_cmd_fingerprint(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
+{
+    static const char hex[] = "0123456789abcdef";
+    char buf[16];
+    uint64_t h;
+    int k;
+
+    if (firstline == false) {
+	output_char(' ');
+    }
+    if (obj == NULL) {
+	if (show_keys == 1)
+	    output_str("(null)=");
+	output_str("null");
+    } else {
+	if (show_keys == 1)
+	    output_path(path, '=');
+	h = hash_canonical(obj);
+	for (k = 15; k >= 0; k--) {
+	    buf[k] = hex[h & 0xf];
+	    h >>= 4;
+	}
+	output_write(buf, sizeof(buf));
+    }
+    if (nonewline) {
+	firstline = false;
+    } else {
+	output_char('\n');
     }
 
     return recurse;
@@ -311,56 +758,56 @@ get_cmd_length(const ucl_object_t *obj, char *nodepath,
  * Return the type of the current object
  */
 int
-get_cmd_type(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_type(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
     if (firstline == false) {
-	fprintf(output, " ");
+	output_char(' ');
     }
     if (obj == NULL) {
 	if (show_keys == 1)
-	    fprintf(output, "(null)=");
-	fprintf(output, "null");
+	    output_str("(null)=");
+	output_str("null");
     } else {
 	if (show_keys == 1)
-	    fprintf(output, "%s=", nodepath);
+	    output_path(path, '=');
 	switch(ucl_object_type(obj)) {
 	case UCL_OBJECT:
-	    fprintf(output, "object");
+	    output_str("object");
 	    break;
 	case UCL_ARRAY:
-	    fprintf(output, "array");
+	    output_str("array");
 	    break;
 	case UCL_INT:
-	    fprintf(output, "int");
+	    output_str("int");
 	    break;
 	case UCL_FLOAT:
-	    fprintf(output, "float");
+	    output_str("float");
 	    break;
 	case UCL_STRING:
-	    fprintf(output, "string");
+	    output_str("string");
 	    break;
 	case UCL_BOOLEAN:
-	    fprintf(output, "boolean");
+	    output_str("boolean");
 	    break;
 	case UCL_TIME:
-	    fprintf(output, "time");
+	    output_str("time");
 	    break;
 	case UCL_USERDATA:
-	    fprintf(output, "userdata");
+	    output_str("userdata");
 	    break;
 	case UCL_NULL:
-	    fprintf(output, "null");
+	    output_str("null");
 	    break;
 	default:
-	    fprintf(output, "unknown");
+	    output_str("unknown");
 	    break;
 	}
     }
     if (nonewline) {
 	firstline = false;
     } else {
-	fprintf(output, "\n");
+	output_char('\n');
     }
 
     return(recurse);
@@ -370,23 +817,23 @@ get_cmd_type(const ucl_object_t *obj, char *nodepath,
  * Return the keys of the current object
  */
 int
-get_cmd_keys(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_keys(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
-    ucl_object_iter_t it = NULL;
+    canon_iter_t ci = { NULL };
     const ucl_object_t *cur;
     int loopcount = 0;
 
     if (obj != NULL) {
-	while ((cur = ucl_iterate_object(obj, &it, true))) {
+	while ((cur = canonical_iterate(obj, &ci, true))) {
 	    if (firstline == false) {
-		fprintf(output, " ");
+		output_char(' ');
 	    }
-	    fprintf(output, "%s", ucl_object_key(cur));
+	    output_str(ucl_object_key(cur));
 	    if (nonewline) {
 		firstline = false;
 	    } else {
-		fprintf(output, "\n");
+		output_char('\n');
 	    }
 	    loopcount++;
 	}
@@ -402,32 +849,33 @@ get_cmd_keys(const ucl_object_t *obj, char *nodepath,
  * Return the values of each key in the current object
  */
 int
-get_cmd_values(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_values(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
-    ucl_object_iter_t it = NULL;
+    canon_iter_t ci = { NULL };
     const ucl_object_t *cur;
+    const char *key;
     int loopcount = 0, arrindex = 0;
-    char *newkey = NULL;
+    size_t mark;
 
     if (obj != NULL) {
-	while ((cur = ucl_iterate_object(obj, &it, true))) {
+	while ((cur = canonical_iterate(obj, &ci, true))) {
 	    if (cur == NULL) {
 		continue;
 	    }
+	    mark = path->len;
 	    if (ucl_object_type(obj) == UCL_ARRAY) {
-		uclcmd_asprintf(&newkey, "%c%i", output_sepchar, arrindex);
+		nodepath_push_index(path, arrindex, output_sepchar);
 		arrindex++;
 	    } else {
-		newkey = __DECONST(char *, ucl_object_key(cur));
-		if (newkey != NULL) {
-		    uclcmd_asprintf(&newkey, "%c%s", output_sepchar, ucl_object_key(cur));
+		key = ucl_object_key(cur);
+		if (key != NULL) {
+		    nodepath_push(path, key, cur->keylen, output_sepchar);
 		}
 	    }
-	    output_key(cur, nodepath, newkey);
+	    output_key(cur, path);
+	    nodepath_pop(path, mark);
 	    loopcount++;
-	    free(newkey);
-	    newkey = NULL;
 	}
     }
     if (loopcount == 0 && debug > 0) {
@@ -441,33 +889,28 @@ get_cmd_values(const ucl_object_t *obj, char *nodepath,
  * Iterate over each key in the object
  */
 int
-get_cmd_iterate(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_iterate(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
     ucl_object_iter_t it = NULL;
     const ucl_object_t *cur;
     int recurse_level = recurse;
     int loopcount = 0;
 
-    if (remaining_commands == NULL) {
+    if (prog->insns[pc + 1].op == GET_OP_END) {
 	it = NULL;
-	char blankkey = '\0';
 	while ((cur = ucl_iterate_object(obj, &it, false))) {
-	    output_chunk(cur, nodepath, &blankkey);
+	    output_chunk(cur, path, path->len);
 	    loopcount++;
 	}
     } else if (obj != NULL) {
-	/* Return the values of the current object */
-	char *rcmds = strdup(remaining_commands);
-	char *next_command = strsep(&rcmds, "|");
-	if (next_command != NULL) {
-	    it = NULL;
-	    while ((cur = ucl_iterate_object(obj, &it, false))) {
-		recurse_level = process_get_command(cur, nodepath,
-		    next_command, rcmds, recurse + 1);
-	    }
-	    loopcount++;
+	/* Run the next command on the values of the current object */
+	it = NULL;
+	while ((cur = ucl_iterate_object(obj, &it, false))) {
+	    recurse_level = process_get_command(cur, path, prog, pc + 1,
+		recurse + 1);
 	}
+	loopcount++;
     }
     if (loopcount == 0 && debug > 0) {
 	fprintf(stderr, "DEBUG: Found 0 objects to each over\n");
@@ -480,74 +923,74 @@ get_cmd_iterate(const ucl_object_t *obj, char *nodepath,
  * Recurse through and output every key
  */
 int
-get_cmd_recurse(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_recurse(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
-    ucl_object_iter_t it = NULL, it2 = NULL;
+    canon_iter_t ci = { NULL };
+    ucl_object_iter_t it2 = NULL;
     const ucl_object_t *cur, *cur2;
-    char *tmpkeyname = NULL;
     int recurse_level = recurse;
     int loopcount = 0, arrindex = 0;
+    size_t mark, top = path->len;
 
-    if (strlen(nodepath) > 0) {
-	output_chunk(obj, nodepath, "");
+    if (top > 0) {
+	output_chunk(obj, path, path->len);
 	if (expand && ucl_object_type(obj) == UCL_ARRAY) {
 	    ucl_object_t *arrlen = NULL;
 
 	    arrlen = ucl_object_fromint(obj->len);
-	    uclcmd_asprintf(&tmpkeyname, "%c%s", output_sepchar, "_length");
-	    output_chunk(arrlen, nodepath, tmpkeyname);
-	    free(tmpkeyname);
+	    mark = nodepath_push(path, "_length", 7, output_sepchar);
+	    output_chunk(arrlen, path, mark);
+	    nodepath_pop(path, mark);
+	    ucl_object_unref(arrlen);
 	}
     }
     if (expand && ucl_object_type(obj) == UCL_OBJECT) {
 	char *keylist = NULL;
 	ucl_object_t *keystr = NULL;
 
-	keylist = expand_subkeys(obj, nodepath);
+	keylist = expand_subkeys(obj, path->buf);
 	if (keylist != NULL) {
 	    keystr = ucl_object_fromstring(keylist);
-	    uclcmd_asprintf(&tmpkeyname, "%c%s", output_sepchar, "_keys");
-	    output_chunk(keystr, nodepath, tmpkeyname);
-	    free(tmpkeyname);
+	    mark = nodepath_push(path, "_keys", 5, output_sepchar);
+	    output_chunk(keystr, path, mark);
+	    nodepath_pop(path, mark);
+	    ucl_object_unref(keystr);
 	    free(keylist);
 	}
     }
-    it = NULL;
-    while ((cur = ucl_iterate_object(obj, &it, true))) {
-	char *newkey = NULL;
-	char *newnodepath = NULL;
+    while ((cur = canonical_iterate(obj, &ci, true))) {
 	if (ucl_object_type(obj) == UCL_ARRAY) {
-	    uclcmd_asprintf(&newkey, "%c%i", output_sepchar, arrindex);
+	    mark = nodepath_push_index(path, arrindex, output_sepchar);
 	    arrindex++;
-	} else if (strlen(nodepath) == 0) {
-	    uclcmd_asprintf(&newkey, "%s", ucl_object_key(cur));
+	} else if (top == 0) {
+	    mark = nodepath_push(path, ucl_object_key(cur), cur->keylen, 0);
 	} else {
-	    uclcmd_asprintf(&newkey, "%c%s", output_sepchar, ucl_object_key(cur));
+	    mark = nodepath_push(path, ucl_object_key(cur), cur->keylen,
+		output_sepchar);
 	}
 	if (expand == 1 && (ucl_object_type(cur) == UCL_OBJECT ||
 		ucl_object_type(cur) == UCL_ARRAY)) {
 	    it2 = NULL;
 	    while ((cur2 = ucl_iterate_object(cur, &it2, false))) {
-		if (nodepath != NULL && strlen(nodepath) > 0) {
-		    uclcmd_asprintf(&newnodepath, "%s%s", nodepath, newkey);
-		} else {
+		if (top == 0) {
+		    /* Below the root the key is not prefixed by a separator */
+		    nodepath_pop(path, mark);
 		    if (ucl_object_type(obj) == UCL_ARRAY) {
-			uclcmd_asprintf(&newnodepath, "%i", arrindex);
+			nodepath_push_index(path, arrindex, 0);
 		    } else {
-			uclcmd_asprintf(&newnodepath, "%s", ucl_object_key(cur2));
+			nodepath_push(path, ucl_object_key(cur2),
+			    cur2->keylen, 0);
 		    }
 		}
-		recurse_level = process_get_command(cur2,
-		    newnodepath, command_str, remaining_commands,
+		recurse_level = process_get_command(cur2, path, prog, pc,
 		    recurse + 1);
 	    }
 	} else {
-	    output_chunk(cur, nodepath, newkey);
+	    output_chunk(cur, path, mark);
 	}
+	nodepath_pop(path, mark);
 	loopcount++;
-	free(newkey);
-	free(newnodepath);
     }
     if (loopcount == 0 && debug > 0) {
 	fprintf(stderr, "DEBUG: Found 0 objects to each over\n");
@@ -560,67 +1003,43 @@ get_cmd_recurse(const ucl_object_t *obj, char *nodepath,
  * Loop over each object and perform the next command on it
  */
 int
-get_cmd_each(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_each(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
-    ucl_object_iter_t it = NULL, it2 = NULL;
+    canon_iter_t ci = { NULL };
+    ucl_object_iter_t it2 = NULL;
     const ucl_object_t *cur, *cur2;
     int recurse_level = recurse;
     int loopcount = 0, arrindex = 0;
+    size_t mark;
 
-    if (remaining_commands == NULL) {
-	it = NULL;
-	while ((cur = ucl_iterate_object(obj, &it, true))) {
-	    char *newkey = NULL;
-	    if (ucl_object_type(obj) == UCL_ARRAY) {
-		uclcmd_asprintf(&newkey, "%c%i", output_sepchar, arrindex);
-		arrindex++;
-	    } else {
-		uclcmd_asprintf(&newkey, "%c%s", output_sepchar, ucl_object_key(cur));
-	    }
-	    if (cur->next != 0 && cur->type != UCL_ARRAY) {
-		/* Implicit array */
-		it2 = NULL;
-		while ((cur2 = ucl_iterate_object(cur, &it2, false))) {
-		    output_chunk(cur2, nodepath, newkey);
-		}
-	    } else {
-		output_chunk(cur, nodepath, newkey);
-	    }
-	    loopcount++;
-	    free(newkey);
+    while (obj != NULL && (cur = canonical_iterate(obj, &ci, true))) {
+	if (ucl_object_type(obj) == UCL_ARRAY) {
+	    mark = nodepath_push_index(path, arrindex, output_sepchar);
+	    arrindex++;
+	} else {
+	    mark = nodepath_push(path, ucl_object_key(cur), cur->keylen,
+		output_sepchar);
 	}
-    } else if (obj != NULL) {
-	/* Return the values of the current object */
-	char *rcmds = strdup(remaining_commands);
-	char *next_command = strsep(&rcmds, "|");
-	if (next_command != NULL) {
-	    it = NULL;
-	    while ((cur = ucl_iterate_object(obj, &it, true))) {
-		char *newnodepath = NULL;
-		if (ucl_object_type(obj) == UCL_ARRAY) {
-		    uclcmd_asprintf(&newnodepath, "%s%c%i", nodepath, output_sepchar,
-			arrindex);
-		    arrindex++;
-		} else {
-		    uclcmd_asprintf(&newnodepath, "%s%c%s", nodepath, output_sepchar,
-			ucl_object_key(cur));
-		}
-		if (cur->next != 0 && cur->type != UCL_ARRAY) {
-		    /* Implicit array */
-		    it2 = NULL;
-		    while ((cur2 = ucl_iterate_object(cur, &it2, false))) {
-			recurse_level = process_get_command(cur2,
-			    newnodepath, next_command, rcmds, recurse + 1);
-		    }
+	if (cur->next != 0 && cur->type != UCL_ARRAY) {
+	    /* Implicit array */
+	    it2 = NULL;
+	    while ((cur2 = ucl_iterate_object(cur, &it2, false))) {
+		if (prog->insns[pc + 1].op == GET_OP_END) {
+		    output_chunk(cur2, path, mark);
 		} else {
-		    recurse_level = process_get_command(cur, newnodepath,
-			next_command, rcmds, recurse + 1);
+		    recurse_level = process_get_command(cur2, path, prog,
+			pc + 1, recurse + 1);
 		}
-		loopcount++;
-		free(newnodepath);
 	    }
+	} else if (prog->insns[pc + 1].op == GET_OP_END) {
+	    output_chunk(cur, path, mark);
+	} else {
+	    recurse_level = process_get_command(cur, path, prog, pc + 1,
+		recurse + 1);
 	}
+	nodepath_pop(path, mark);
+	loopcount++;
     }
     if (loopcount == 0 && debug > 0) {
 	fprintf(stderr, "DEBUG: Found 0 objects to each over\n");
@@ -633,59 +1052,60 @@ get_cmd_each(const ucl_object_t *obj, char *nodepath,
  * Get a regular key
  */
 int
-get_cmd_none(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_none(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
+    const get_insn_t *insn = &prog->insns[pc];
     const ucl_object_t *cur;
-    char *reqnodelist = strdup(command_str);
-    char *reqnode = NULL;
+    const char *key;
     int recurse_level = recurse;
-    int arrindex = 0;
+    int arrindex = 0, i;
+    size_t mark;
 
-    /* Separate and loop here */
-    while ((reqnode = strsep(&reqnodelist, " ")) != NULL) {
+    /* Loop over the space separated paths */
+    for (i = 0; i < insn->npaths; i++) {
 	/* User has provided an identifier after the commands */
 	/* Search for selected node */
 	if (debug > 0) {
-	    fprintf(stderr, "DEBUG: Searching for subnode %s\n", reqnode);
+	    fprintf(stderr, "DEBUG: Searching for subnode %s\n",
+		insn->paths[i].text);
 	}
-	cur = ucl_lookup_path_char(obj, reqnode, input_sepchar);
+	cur = get_path_lookup(obj, &insn->paths[i]);
 	/* If this is the last thing on the stack, output */
-	if (remaining_commands == NULL) {
+	if (prog->insns[pc + 1].op == GET_OP_END) {
 	    /* Would also check cur==null here, but that breaks |keys */
-	    output_key(cur, nodepath, reqnode);
+	    mark = nodepath_push(path, insn->paths[i].text,
+		strlen(insn->paths[i].text), 0);
+	    output_key(cur, path);
 	} else {
-	    /* Return the values of the current object */
-	    char *rcmds = strdup(remaining_commands);
-	    char *next_command = strsep(&rcmds, "|");
-	    if (next_command != NULL) {
-		char *newnodepath = NULL;
-		if (ucl_object_type(obj) == UCL_ARRAY) {
-		    uclcmd_asprintf(&newnodepath, "%s%c%i", nodepath, output_sepchar,
-			arrindex);
-		    arrindex++;
-		} else {
-		    uclcmd_asprintf(&newnodepath, "%s%c%s", nodepath, output_sepchar,
-			ucl_object_key(cur));
-		}
-		if (debug > 2) {
-		    fprintf(stderr, "DEBUG: Calling recurse with %s.%s on %s\n",
-			newnodepath, next_command,
-			ucl_object_emit(cur, UCL_EMIT_CONFIG));
+	    /* Run the next command on the current object */
+	    if (ucl_object_type(obj) == UCL_ARRAY) {
+		mark = nodepath_push_index(path, arrindex, output_sepchar);
+		arrindex++;
+	    } else {
+		key = ucl_object_key(cur);
+		if (key == NULL) {
+		    key = "(null)";
 		}
-		recurse_level = process_get_command(cur, newnodepath,
-		    next_command, rcmds, recurse + 1);
-		free(newnodepath);
+		mark = nodepath_push(path, key, strlen(key), output_sepchar);
+	    }
+	    if (debug > 2) {
+		fprintf(stderr, "DEBUG: Calling recurse with %s.%s on %s\n",
+		    path->buf, prog->insns[pc + 1].name,
+		    ucl_object_emit(cur, UCL_EMIT_CONFIG));
 	    }
+	    recurse_level = process_get_command(cur, path, prog, pc + 1,
+		recurse + 1);
 	}
+	nodepath_pop(path, mark);
     }
 
     return(recurse_level);
 }
 
 int
-get_cmd_tab(const ucl_object_t *obj, char *nodepath,
-    const char *command_str, char *remaining_commands, int recurse)
+get_cmd_tab(const ucl_object_t *obj, nodepath_t *path,
+    const get_prog_t *prog, int pc, int recurse)
 {
     return(recurse);
 }
@@ -0,0 +1,667 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Sidecar path index
+ *
+ * uclcmd index -f file walks a JSON file once and writes file.uclidx next to
+ * it: a sorted table of every full key path and the byte range of its value
+ * in the file, keyed on the identity (device, inode, size, mtime) and a hash
+ * of the source.  A get of a single path then reads and parses only that
+ * range.  If the identity no longer matches, the hash is checked before the
+ * index is given up on, so a copied or touched file keeps its index.
+ *
+ * In the index a path is its segments separated by NUL bytes.  Keys that
+ * are empty cannot be looked up and are left out, keys with escapes or
+ * duplicates make the file unindexable.  Anything not found in the index is
+ * looked up by parsing the whole file, as if there was no index.
+ */
+
+#include "uclcmd.h"
+
+#define	INDEX_MAGIC	"UCLINDEX"
+#define	INDEX_VERSION	1
+#define	INDEX_SUFFIX	".uclidx"
+#define	INDEX_MAXDEPTH	128
+
+struct index_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	reserved;
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime_sec;
+	int64_t		mtime_nsec;
+	uint64_t	hash;
+	uint64_t	nentries;
+	uint64_t	keys_len;
+};
+
+struct index_entry {
+	uint64_t	key_off;	/* into the key table */
+	uint64_t	key_len;
+	uint64_t	val_off;	/* into the source */
+	uint64_t	val_len;
+};
+
+struct index_build {
+	const unsigned char	*base;
+	const unsigned char	*end;
+	struct index_entry	*entries;
+	size_t			nentries;
+	size_t			entries_size;
+	char			*keys;
+	size_t			keys_len;
+	size_t			keys_size;
+	char			*path;		/* path being walked */
+	size_t			path_len;
+	size_t			path_size;
+	int			depth;
+};
+
+/* Key table used by index_cmp() */
+static const char *index_keys;
+
+static void*
+index_grow(void *buf, size_t *size, size_t need, size_t elem)
+{
+
+    if (need <= *size) {
+	return buf;
+    }
+    while (*size < need) {
+	*size = *size > 0 ? *size * 2 : 1024;
+    }
+    buf = realloc(buf, *size * elem);
+    if (buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    return buf;
+}
+
+static size_t
+index_push(struct index_build *b, const unsigned char *seg, size_t len)
+{
+    size_t mark = b->path_len;
+
+    b->path = index_grow(b->path, &b->path_size, b->path_len + len + 1, 1);
+    if (b->path_len > 0) {
+	b->path[b->path_len++] = '\0';
+    }
+    memcpy(b->path + b->path_len, seg, len);
+    b->path_len += len;
+
+    return mark;
+}
+
+static void
+index_add(struct index_build *b, size_t off, size_t len)
+{
+    struct index_entry *e;
+
+    b->entries = index_grow(b->entries, &b->entries_size, b->nentries + 1,
+	sizeof(*b->entries));
+    b->keys = index_grow(b->keys, &b->keys_size, b->keys_len + b->path_len,
+	1);
+    e = &b->entries[b->nentries++];
+    e->key_off = b->keys_len;
+    e->key_len = b->path_len;
+    e->val_off = off;
+    e->val_len = len;
+    memcpy(b->keys + b->keys_len, b->path, b->path_len);
+    b->keys_len += b->path_len;
+}
+
+/*
+ * Record every path below the value at p, return the byte after it or NULL
+ * if the input can not be indexed
+ */
+static const unsigned char*
+index_walk(struct index_build *b, const unsigned char *p)
+{
+    const unsigned char *key, *start;
+    unsigned long n = 0;
+    char num[32];
+    size_t len, mark;
+    bool obj;
+
+    if (*p != '{' && *p != '[') {
+	return scan_skip(p, b->end);
+    }
+    if (++b->depth > INDEX_MAXDEPTH) {
+	return NULL;
+    }
+    obj = *p == '{';
+    p = scan_ws(p + 1, b->end);
+    if (p < b->end && *p == (obj ? '}' : ']')) {
+	b->depth--;
+	return p + 1;
+    }
+    for (;;) {
+	if (obj) {
+	    if (p >= b->end || *p != '"') {
+		return NULL;
+	    }
+	    key = p + 1;
+	    p = scan_string(key, b->end);
+	    if (p == NULL) {
+		return NULL;
+	    }
+	    len = p - 1 - key;
+	    if (memchr(key, '\\', len) != NULL) {
+		return NULL;
+	    }
+	    p = scan_ws(p, b->end);
+	    if (p >= b->end || *p != ':') {
+		return NULL;
+	    }
+	    p = scan_ws(p + 1, b->end);
+	} else {
+	    len = snprintf(num, sizeof(num), "%lu", n++);
+	    key = (const unsigned char *)num;
+	}
+	if (p >= b->end) {
+	    return NULL;
+	}
+	start = p;
+	if (len == 0) {
+	    p = scan_skip(p, b->end);
+	} else {
+	    mark = index_push(b, key, len);
+	    p = index_walk(b, p);
+	    if (p != NULL) {
+		index_add(b, start - b->base, p - start);
+	    }
+	    b->path_len = mark;
+	}
+	if (p == NULL) {
+	    return NULL;
+	}
+	p = scan_ws(p, b->end);
+	if (p < b->end && *p == ',') {
+	    p = scan_ws(p + 1, b->end);
+	    continue;
+	}
+	if (p < b->end && *p == (obj ? '}' : ']')) {
+	    b->depth--;
+	    return p + 1;
+	}
+	return NULL;
+    }
+}
+
+static int
+index_keycmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c;
+
+    c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0) {
+	return c;
+    }
+
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int
+index_cmp(const void *a, const void *b)
+{
+    const struct index_entry *ea = a, *eb = b;
+
+    return index_keycmp(index_keys + ea->key_off, ea->key_len,
+	index_keys + eb->key_off, eb->key_len);
+}
+
+static void
+index_identity(const struct stat *st, struct index_header *hdr)
+{
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic));
+    hdr->version = INDEX_VERSION;
+    hdr->dev = st->st_dev;
+    hdr->ino = st->st_ino;
+    hdr->size = st->st_size;
+    hdr->mtime_sec = st->st_mtim.tv_sec;
+    hdr->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/*
+ * Hash of the source, which is mapped for the time it takes
+ */
+static bool
+index_hash(int fd, size_t size, uint64_t *hash)
+{
+    void *map;
+
+    if (size == 0) {
+	*hash = hash_buffer("", 0);
+	return true;
+    }
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	return false;
+    }
+    (void)madvise(map, size, MADV_SEQUENTIAL);
+    *hash = hash_buffer(map, size);
+    munmap(map, size);
+
+    return true;
+}
+
+/*
+ * Rewrite the index idx, mapped at map, with the identity in hdr.  Failing
+ * only means the source is hashed again next time.
+ */
+static void
+index_restamp(const char *idx, const unsigned char *map, size_t len,
+    const struct index_header *hdr)
+{
+    char *tmp = NULL;
+    FILE *out = NULL;
+    struct stat st;
+    bool success;
+    int fd;
+
+    uclcmd_asprintf(&tmp, "%s.XXXXXXXXXX", idx);
+    fd = mkstemp(tmp);
+    if (fd == -1) {
+	free(tmp);
+	return;
+    }
+    if (stat(idx, &st) == 0) {
+	(void)fchmod(fd, st.st_mode & 0644);
+    }
+    out = fdopen(fd, "w");
+    if (out == NULL) {
+	close(fd);
+	unlink(tmp);
+	free(tmp);
+	return;
+    }
+    success = fwrite(hdr, sizeof(*hdr), 1, out) == 1 &&
+	(len == sizeof(*hdr) ||
+	fwrite(map + sizeof(*hdr), len - sizeof(*hdr), 1, out) == 1);
+    if (fclose(out) != 0) {
+	success = false;
+    }
+    if (success && rename(tmp, idx) == 0) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Updated the identity in index %s\n", idx);
+	}
+    } else {
+	unlink(tmp);
+    }
+    free(tmp);
+}
+
+/*
+ * Write the index of src, quiet is for replace_file() which only wants to
+ * know if it worked
+ */
+static bool
+index_build(const char *src, bool quiet)
+{
+    struct index_build b;
+    struct index_header hdr;
+    struct stat st;
+    const unsigned char *p;
+    unsigned char *map = NULL;
+    const char *why = NULL;
+    char *idx = NULL, *tmp = NULL;
+    FILE *out = NULL;
+    size_t k;
+    int fd;
+
+    memset(&b, 0, sizeof(b));
+    fd = open(src, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	st.st_size == 0) {
+	why = fd == -1 ? strerror(errno) : "not a regular JSON file";
+	goto out;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	map = NULL;
+	why = strerror(errno);
+	goto out;
+    }
+    close(fd);
+    fd = -1;
+    (void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+    index_identity(&st, &hdr);
+    hdr.hash = hash_buffer(map, st.st_size);
+
+    b.base = map;
+    b.end = map + st.st_size;
+    p = scan_ws(b.base, b.end);
+    if (p < b.end && (*p == '{' || *p == '[')) {
+	p = index_walk(&b, p);
+    } else {
+	p = NULL;
+    }
+    if (p == NULL || scan_ws(p, b.end) != b.end) {
+	why = "not plain JSON";
+	goto out;
+    }
+
+    index_keys = b.keys;
+    qsort(b.entries, b.nentries, sizeof(*b.entries), index_cmp);
+    for (k = 1; k < b.nentries; k++) {
+	if (index_cmp(&b.entries[k - 1], &b.entries[k]) == 0) {
+	    why = "duplicate keys";
+	    goto out;
+	}
+    }
+    hdr.nentries = b.nentries;
+    hdr.keys_len = b.keys_len;
+
+    uclcmd_asprintf(&idx, "%s%s", src, INDEX_SUFFIX);
+    uclcmd_asprintf(&tmp, "%s.XXXXXXXXXX", idx);
+    fd = mkstemp(tmp);
+    if (fd == -1) {
+	why = strerror(errno);
+	goto out;
+    }
+    /* Readable by whoever can read the source */
+    (void)fchmod(fd, st.st_mode & 0644);
+    out = fdopen(fd, "w");
+    if (out == NULL) {
+	why = strerror(errno);
+	unlink(tmp);
+	goto out;
+    }
+    fd = -1;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	(b.nentries > 0 && fwrite(b.entries, sizeof(*b.entries), b.nentries,
+	out) != b.nentries) ||
+	(b.keys_len > 0 && fwrite(b.keys, b.keys_len, 1, out) != 1)) {
+	why = strerror(errno);
+    }
+    if (fclose(out) != 0 && why == NULL) {
+	why = strerror(errno);
+    }
+    if (why == NULL && rename(tmp, idx) != 0) {
+	why = strerror(errno);
+    }
+    if (why != NULL) {
+	unlink(tmp);
+    } else if (debug > 0) {
+	fprintf(stderr, "DEBUG: Indexed %zu paths of %s in %s\n", b.nentries,
+	    src, idx);
+    }
+
+out:
+    if (why != NULL && (!quiet || debug > 0)) {
+	fprintf(stderr, "Error: cannot index %s: %s\n", src, why);
+    }
+    if (fd != -1) {
+	close(fd);
+    }
+    if (map != NULL) {
+	munmap(map, st.st_size);
+    }
+    free(b.entries);
+    free(b.keys);
+    free(b.path);
+    free(idx);
+    free(tmp);
+
+    return why == NULL;
+}
+
+int
+index_main(int argc, char *argv[])
+{
+    int ch;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "file",	required_argument,	NULL,		'f' },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "df:", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'f':
+	    filename = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+	usage();
+    }
+
+    return index_build(filename, false) ? 0 : 2;
+}
+
+/*
+ * Called when src has been rewritten: bring its index, if it has one, up
+ * to date or remove it
+ */
+void
+index_refresh(const char *src)
+{
+    char *idx = NULL;
+
+    uclcmd_asprintf(&idx, "%s%s", src, INDEX_SUFFIX);
+    if (access(idx, F_OK) == 0 && !index_build(src, true)) {
+	unlink(idx);
+    }
+    free(idx);
+}
+
+/*
+ * Find path (up to any '|') in the index of src.  If it is there, root_obj
+ * is set to a tree holding just its value, which is returned.  NULL means
+ * the file has to be parsed as usual.
+ */
+const ucl_object_t*
+index_lookup(const char *src, const char *path)
+{
+    struct index_header hdr, want;
+    const struct index_entry *entries, *e;
+    const char *keys, *seg, *end;
+    struct ucl_parser *iparser;
+    struct stat st, ist;
+    unsigned char *map = NULL, *buf = NULL;
+    const ucl_object_t *found = NULL;
+    char realbuf[PATH_MAX], *idx = NULL, *key = NULL;
+    size_t keylen = 0, lo, hi, mid, len, got;
+    ssize_t r;
+    int c, fd = -1, ifd = -1;
+
+    uclcmd_asprintf(&idx, "%s%s", src, INDEX_SUFFIX);
+    ifd = open(idx, O_RDONLY);
+    if (ifd == -1 || fstat(ifd, &ist) != 0 ||
+	(size_t)ist.st_size < sizeof(hdr)) {
+	goto out;
+    }
+    map = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+    if (map == MAP_FAILED) {
+	map = NULL;
+	goto out;
+    }
+    memcpy(&hdr, map, sizeof(hdr));
+    if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+	hdr.version != INDEX_VERSION ||
+	hdr.nentries > (ist.st_size - sizeof(hdr)) / sizeof(*entries) ||
+	sizeof(hdr) + hdr.nentries * sizeof(*entries) + hdr.keys_len !=
+	(uint64_t)ist.st_size) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Ignoring corrupt index %s\n", idx);
+	}
+	goto out;
+    }
+
+    fd = open(src, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+	goto out;
+    }
+    index_identity(&st, &want);
+    want.hash = hdr.hash;
+    want.nentries = hdr.nentries;
+    want.keys_len = hdr.keys_len;
+    if (memcmp(&want, &hdr, sizeof(hdr)) != 0) {
+	if (want.size != hdr.size || !index_hash(fd, st.st_size, &want.hash) ||
+	    want.hash != hdr.hash) {
+	    if (debug > 0) {
+		fprintf(stderr, "DEBUG: Index %s is stale\n", idx);
+	    }
+	    goto out;
+	}
+	/* The same content under a new identity, don't hash it every time */
+	index_restamp(idx, map, ist.st_size, &want);
+    }
+
+    /* The requested path as it is stored: segments separated by NUL */
+    key = malloc(strlen(path) + 1);
+    if (key == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (seg = path; *seg != '\0' && *seg != '|'; seg = end) {
+	for (end = seg; *end != '\0' && *end != '|' && *end != input_sepchar;
+	    end++)
+	    ;
+	if (end > seg) {
+	    if (keylen > 0) {
+		key[keylen++] = '\0';
+	    }
+	    memcpy(key + keylen, seg, end - seg);
+	    keylen += end - seg;
+	}
+	if (*end == input_sepchar) {
+	    end++;
+	}
+    }
+    if (keylen == 0) {
+	goto out;
+    }
+
+    entries = (const struct index_entry *)(map + sizeof(hdr));
+    keys = (const char *)(entries + hdr.nentries);
+    e = NULL;
+    lo = 0;
+    hi = hdr.nentries;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (entries[mid].key_off + entries[mid].key_len > hdr.keys_len) {
+	    break;
+	}
+	c = index_keycmp(key, keylen, keys + entries[mid].key_off,
+	    entries[mid].key_len);
+	if (c == 0) {
+	    e = &entries[mid];
+	    break;
+	} else if (c < 0) {
+	    hi = mid;
+	} else {
+	    lo = mid + 1;
+	}
+    }
+    if (e == NULL || e->val_off + e->val_len > (uint64_t)st.st_size) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: %s is not in index %s\n", path, idx);
+	}
+	goto out;
+    }
+
+    /* Parse just the value, as {"v": value} */
+    len = e->val_len + 6;
+    buf = malloc(len);
+    if (buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    memcpy(buf, "{\"v\":", 5);
+    for (got = 0; got < e->val_len; got += r) {
+	r = pread(fd, buf + 5 + got, e->val_len - got, e->val_off + got);
+	if (r <= 0) {
+	    if (r < 0 && errno == EINTR) {
+		r = 0;
+		continue;
+	    }
+	    goto out;
+	}
+    }
+    buf[len - 1] = '}';
+
+    /* A private parser, so that falling back still has a clean one */
+    iparser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
+    if (realpath(src, realbuf) == NULL) {
+	snprintf(realbuf, sizeof(realbuf), "%s", src);
+    }
+    ucl_parser_set_filevars(iparser, realbuf, false);
+    if (parse_chunk(iparser, buf, len, UCL_PARSE_UCL)) {
+	root_obj = ucl_parser_get_object(iparser);
+	found = ucl_object_lookup(root_obj, "v");
+	if (found == NULL) {
+	    ucl_object_unref(root_obj);
+	    root_obj = NULL;
+	}
+    }
+    ucl_parser_free(iparser);
+    if (debug > 0 && found != NULL) {
+	fprintf(stderr, "DEBUG: Parsed %zu bytes at %ju of %s from index %s\n",
+	    (size_t)e->val_len, (uintmax_t)e->val_off, src, idx);
+    }
+
+out:
+    if (map != NULL) {
+	munmap(map, ist.st_size);
+    }
+    if (ifd != -1) {
+	close(ifd);
+    }
+    if (fd != -1) {
+	close(fd);
+    }
+    free(buf);
+    free(key);
+    free(idx);
+
+    return found;
+}
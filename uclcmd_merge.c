@@ -31,14 +31,17 @@
 int
 merge_main(int argc, char *argv[])
 {
-    int ret = 0, ch;
+    int ret = 0, ch, k, njobs;
     bool success = false;
+    filelist_t bases = { NULL, 0, 0 }, overlays = { NULL, 0, 0 };
+    parse_job_t *jobs = NULL;
 
     /* Set the default output type */
     output_type = UCL_EMIT_CONFIG;
 
     /*	options	descriptor */
     static struct option longopts[] = {
+	{ "canonical",	no_argument,		&canonical,	1 },
 	{ "cjson",	no_argument,		&output_type,
 	    UCL_EMIT_JSON_COMPACT },
 	{ "debug",	optional_argument,	NULL,		'd' },
@@ -50,12 +53,14 @@ merge_main(int argc, char *argv[])
 	{ "keys",	no_argument,		&show_keys,	1 },
 	{ "input",	no_argument,		NULL,		'i' },
 	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
 	{ "msgpack",	no_argument,		&output_type,
 	    UCL_EMIT_MSGPACK },
 	{ "noop",	no_argument,		&noop,		1 },
 	{ "nonewline",	no_argument,		&nonewline,	1 },
 	{ "noquotes",	no_argument,		&show_raw,	1 },
 	{ "output",	required_argument,	NULL,		'o' },
+	{ "policy",	required_argument,	NULL,		'P' },
 	{ "shellvars",	no_argument,		NULL,		'l' },
 	{ "ucl",	no_argument,		&output_type,
 	    UCL_EMIT_CONFIG },
@@ -83,14 +88,20 @@ merge_main(int argc, char *argv[])
 	    expand = 1;
 	    break;
 	case 'f':
-	    filename = optarg;
+	    filelist_add(&bases, optarg);
 	    break;
 	case 'i':
-	    include_file = optarg;
+	    filelist_add(&overlays, optarg);
 	    break;
 	case 'I':
 	    pflags |= UCL_PARSER_KEY_LOWERCASE;
 	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 'P':
+	    merge_policy = string_to_policy(optarg);
+	    break;
 	case 'j':
 	    output_type = UCL_EMIT_JSON;
 	    break;
@@ -140,7 +151,45 @@ merge_main(int argc, char *argv[])
     /* Initialize parser */
     parser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
 
-    if (filename == NULL || strcmp(filename, "-") == 0) {
+    njobs = bases.count + overlays.count;
+    if (njobs > 1) {
+	/*
+	 * Parse every file at once, then fold the -f files into the tree
+	 * and the -i files into what is merged into it, each in order
+	 */
+	jobs = calloc(njobs, sizeof(*jobs));
+	if (jobs == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	    abort();
+	}
+	for (k = 0; k < bases.count; k++) {
+	    jobs[k].name = bases.names[k];
+	    jobs[k].flags = UCLCMD_PARSER_FLAGS | pflags;
+	}
+	for (k = 0; k < overlays.count; k++) {
+	    jobs[bases.count + k].name = overlays.names[k];
+	    /* The same flags as merge_mode() uses */
+	    jobs[bases.count + k].flags = UCL_PARSER_KEY_LOWERCASE |
+		UCL_PARSER_NO_IMPLICIT_ARRAYS;
+	}
+	parse_files(jobs, njobs);
+	if (bases.count > 0) {
+	    root_obj = merge_fold(jobs, bases.count);
+	}
+	if (overlays.count > 0) {
+	    set_obj = merge_fold(jobs + bases.count, overlays.count);
+	}
+	free(jobs);
+    } else if (overlays.count == 1) {
+	include_file = overlays.names[0];
+    }
+    if (bases.count > 0) {
+	filename = bases.names[0];
+    }
+
+    if (root_obj != NULL) {
+	/* Already folded from several files */
+    } else if (filename == NULL || strcmp(filename, "-") == 0) {
 	/* Input from STDIN */
 	root_obj = parse_input(parser, stdin);
     } else {
@@ -161,6 +210,8 @@ merge_main(int argc, char *argv[])
     }
 
     cleanup();
+    filelist_free(&bases);
+    filelist_free(&overlays);
 
     return(ret);
 }
@@ -188,7 +239,9 @@ merge_mode(char *destination_node, char *data)
 	return false;
     }
 
-    if (include_file != NULL) {
+    if (set_obj != NULL) {
+	/* Folded from several files by merge_main() */
+    } else if (include_file != NULL) {
 	/* get UCL to add from file */
 	set_obj = parse_file(setparser, include_file);
     } else if (data == NULL || strcmp(data, "-") == 0) {
@@ -222,9 +275,9 @@ merge_mode(char *destination_node, char *data)
     }
     /* Add it to the object here */
     if (sub_obj == dst_obj && *dst_frag != '\0') {
-	/* Sub-object does not exist, create a new one */
-	success = ucl_object_insert_key(dst_obj, set_obj, dst_frag, 0,
-	    true);
+	/* Sub-object does not exist, create a new one (unref in cleanup()) */
+	success = ucl_object_insert_key(dst_obj, ucl_object_ref(set_obj),
+	    dst_frag, 0, true);
     } else if (ucl_object_type(sub_obj) == UCL_ARRAY && ucl_object_type(set_obj) == UCL_ARRAY) {
 	if (debug > 0) {
 	    fprintf(stderr, "Merging array of size %u with array of size %u\n",
@@ -250,7 +303,7 @@ merge_mode(char *destination_node, char *data)
 	/*
 	success = ucl_object_merge(sub_obj, set_obj, false);
 	*/
-	success = merge_recursive(sub_obj, set_obj, false);
+	success = merge_recursive(sub_obj, set_obj, merge_policy);
     } else if (ucl_object_type(sub_obj) != UCL_OBJECT && ucl_object_type(sub_obj) != UCL_ARRAY) {
 	/* Create an explicit array */
 	if (debug > 0) {
@@ -290,82 +343,232 @@ merge_mode(char *destination_node, char *data)
     return success;
 }
 
-bool
-merge_recursive(ucl_object_t *top, ucl_object_t *elt, bool copy)
+/*
+ * Merge the trees parse_files() produced into the first, in order, so that
+ * each file overrides the ones before it
+ */
+ucl_object_t*
+merge_fold(parse_job_t *jobs, int njobs)
+{
+    ucl_object_t *top = jobs[0].obj;
+    int k;
+
+    for (k = 1; k < njobs; k++) {
+	if (ucl_object_type(top) != UCL_OBJECT ||
+	    ucl_object_type(jobs[k].obj) != UCL_OBJECT) {
+	    fprintf(stderr, "Error: Cannot merge %s into %s, both must be "
+		"objects\n", jobs[k].name, jobs[0].name);
+	    cleanup();
+	    exit(1);
+	}
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Merging %s\n", jobs[k].name);
+	}
+	if (!merge_recursive(top, jobs[k].obj, merge_policy)) {
+	    fprintf(stderr, "Error: Failed to merge %s\n", jobs[k].name);
+	    cleanup();
+	    exit(1);
+	}
+	ucl_object_unref(jobs[k].obj);
+	jobs[k].obj = NULL;
+    }
+
+    return top;
+}
+
+#define MERGE_POLICY_KEY	".merge"
+
+enum merge_policy
+string_to_policy(const char *strpolicy)
+{
+
+    if (strcasecmp(strpolicy, "error") == 0) {
+	return MERGE_ERROR;
+    } else if (strcasecmp(strpolicy, "replace") == 0) {
+	return MERGE_REPLACE;
+    } else if (strcasecmp(strpolicy, "append") == 0) {
+	return MERGE_APPEND;
+    } else if (strcasecmp(strpolicy, "merge") != 0) {
+	fprintf(stderr, "Error: Unknown merge policy: %s\n", strpolicy);
+	usage();
+    }
+
+    return MERGE_MERGE;
+}
+
+/*
+ * The policy an object of the overlay asks for with a .merge key, or the
+ * one inherited from its parent
+ */
+static int
+merge_policy_of(const ucl_object_t *obj, enum merge_policy inherited)
+{
+    const ucl_object_t *pol;
+
+    if (ucl_object_type(obj) != UCL_OBJECT) {
+	return inherited;
+    }
+    pol = ucl_object_lookup_len(obj, MERGE_POLICY_KEY,
+	sizeof(MERGE_POLICY_KEY) - 1);
+    if (pol == NULL) {
+	return inherited;
+    }
+    if (ucl_object_type(pol) != UCL_STRING) {
+	fprintf(stderr, "Error: %s of %s must be a string\n",
+	    MERGE_POLICY_KEY, ucl_object_key(obj));
+	return -1;
+    }
+
+    return string_to_policy(ucl_object_tostring(pol));
+}
+
+/*
+ * Drop the .merge keys from a subtree of the overlay that is about to be
+ * inserted as is, they only steer the merge
+ */
+static void
+merge_strip(ucl_object_t *obj)
 {
     const ucl_object_t *cur;
     ucl_object_iter_t it = NULL;
-    ucl_object_t *found = NULL, *cp_obj = NULL;
-    bool success = false;
 
-    it = ucl_object_iterate_new(elt);
+    if (ucl_object_type(obj) != UCL_OBJECT &&
+	    ucl_object_type(obj) != UCL_ARRAY) {
+	return;
+    }
+    if (ucl_object_type(obj) == UCL_OBJECT) {
+	ucl_object_delete_keyl(obj, MERGE_POLICY_KEY,
+	    sizeof(MERGE_POLICY_KEY) - 1);
+    }
+    while ((cur = ucl_object_iterate(obj, &it, false))) {
+	merge_strip(__DECONST(ucl_object_t *, cur));
+    }
+}
 
-    while ((cur = ucl_object_iterate_safe(it, false))) {
-	cp_obj = ucl_object_ref(cur);
-	if (debug > 0) {
-	    fprintf(stderr, "DEBUG: Looping over (elt)%s, found key: %s\n",
-		ucl_object_key(top), ucl_object_key(cur));
+static bool
+merge_tree(ucl_object_t *top, const ucl_object_t *elt, int policy)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    ucl_object_t *found, *cp_obj, *tmp_obj;
+    const char *key;
+    size_t keylen;
+    int p;
+    bool success = true;
+
+    /* Room for every new key up front, rather than growing as they arrive */
+    if (elt->len > 8) {
+	ucl_object_reserve(top, top->len + elt->len);
+    }
+
+    while (success && (cur = ucl_object_iterate(elt, &it, false))) {
+	key = ucl_object_keyl(cur, &keylen);
+	if (keylen == sizeof(MERGE_POLICY_KEY) - 1 &&
+		memcmp(key, MERGE_POLICY_KEY, keylen) == 0) {
+	    continue;
 	}
-	if (ucl_object_type(cur) == UCL_OBJECT) {
-	    found = __DECONST(ucl_object_t *, ucl_object_find_key(top, ucl_object_key(cur)));
-	    if (found == NULL) {
-		/* new key not found in old object, insert it */
-		if (debug > 0) {
-		    fprintf(stderr, "DEBUG: unmatched key, inserting: %s into top\n",
-			ucl_object_key(cur));
-		}
-		success = ucl_object_insert_key_merged(top, cp_obj,
-		    ucl_object_key(cp_obj), 0, true);
-		if (success == false) { return false; }
-		continue;
+	p = merge_policy_of(cur, policy);
+	if (p == -1) {
+	    return false;
+	}
+	cp_obj = __DECONST(ucl_object_t *, cur);
+
+	/* The one lookup of this key, everything below works from found */
+	found = __DECONST(ucl_object_t *, ucl_object_lookup_len(top, key,
+	    keylen));
+	if (found == NULL) {
+	    /* new key not found in old object, insert it */
+	    if (debug > 0) {
+		fprintf(stderr, "DEBUG: inserting %s into %s\n", key,
+		    ucl_object_key(top));
 	    }
+	    merge_strip(cp_obj);
+	    success = ucl_object_insert_key(top, ucl_object_ref(cur), key,
+		keylen, false);
+	    continue;
+	}
+
+	if (p != MERGE_REPLACE && ucl_object_type(found) == UCL_OBJECT &&
+		ucl_object_type(cur) == UCL_OBJECT) {
 	    if (debug > 0) {
-		fprintf(stderr, "DEBUG: (obj) Found key %s in (top)%s too, merging...\n",
-		    ucl_object_key(found), ucl_object_key(top));
+		fprintf(stderr, "DEBUG: (obj) Found key %s in (top)%s too, "
+		    "merging...\n", key, ucl_object_key(top));
 	    }
-	    success = merge_recursive(found, cp_obj, copy);
-	    if (success == false) { return false; }
-	} else if (ucl_object_type(cur) == UCL_ARRAY) {
-	    found = __DECONST(ucl_object_t *, ucl_object_find_key(top, ucl_object_key(cur)));
-	    if (found == NULL) {
-		/* new key not found in old object, insert it */
-		if (debug > 0) {
-		    fprintf(stderr, "DEBUG: unmatched key, inserting: %s into top\n",
-			ucl_object_key(cur));
-		}
-		success = ucl_object_insert_key_merged(top, cp_obj,
-		    ucl_object_key(cp_obj), 0, true);
-		if (success == false) { return false; }
-		continue;
+	    success = merge_tree(found, cur, p);
+	    continue;
+	}
+
+	switch (p) {
+	case MERGE_ERROR:
+	    fprintf(stderr, "Error: %s is already set in %s\n", key,
+		ucl_object_key(top));
+	    success = false;
+	    break;
+	case MERGE_APPEND:
+	    if (ucl_object_type(found) != UCL_ARRAY) {
+		/*
+		 * Create an explicit array holding the old value.  key
+		 * belongs to cur, which the array does not keep, so copy it.
+		 */
+		tmp_obj = ucl_object_typed_new(UCL_ARRAY);
+		ucl_array_append(tmp_obj, ucl_object_ref(found));
+		success = ucl_object_replace_key(top, tmp_obj, key, keylen,
+		    true);
+		found = tmp_obj;
 	    }
-	    if (debug > 0) {
-		fprintf(stderr, "DEBUG: (arr) Found key %s in (top)%s too, merging...\n",
-		    ucl_object_key(found), ucl_object_key(top));
+	    merge_strip(cp_obj);
+	    if (ucl_object_type(cur) == UCL_ARRAY) {
+		success = success && ucl_array_merge(found, cp_obj, true);
+	    } else {
+		success = success && ucl_array_append(found,
+		    ucl_object_ref(cur));
 	    }
-	    success = ucl_array_merge(found, cp_obj, true);
-	    if (success == false) { return false; }
-	} else {
-	    found = __DECONST(ucl_object_t *, ucl_object_find_key(top, ucl_object_key(cur)));
-	    if (found == NULL) {
-		/* new key not found in old object, insert it */
+	    break;
+	case MERGE_MERGE:
+	    if (ucl_object_type(found) == UCL_ARRAY &&
+		    ucl_object_type(cur) == UCL_ARRAY) {
 		if (debug > 0) {
-		    fprintf(stderr, "DEBUG: inserting %s into %s\n",
-			ucl_object_key(cur), ucl_object_key(top));
+		    fprintf(stderr, "DEBUG: (arr) Found key %s in (top)%s too, "
+			"merging...\n", key, ucl_object_key(top));
 		}
-		success = ucl_object_insert_key_merged(top, ucl_object_ref(cur),
-		    ucl_object_key(cur), 0, true);
-		if (success == false) { return false; }
-		continue;
+		merge_strip(cp_obj);
+		success = ucl_array_merge(found, cp_obj, true);
+		break;
 	    }
+	    /* FALLTHROUGH */
+	case MERGE_REPLACE:
 	    if (debug > 0) {
-		fprintf(stderr, "DEBUG: replacing %s in %s\n",
-		    ucl_object_key(found), ucl_object_key(top));
+		fprintf(stderr, "DEBUG: replacing %s in %s\n", key,
+		    ucl_object_key(top));
 	    }
-	    success = ucl_object_replace_key(top, cp_obj,
-		ucl_object_key(cp_obj), 0, true);
-	    if (success == false) { return false; }
+	    merge_strip(cp_obj);
+	    success = ucl_object_replace_key(top, ucl_object_ref(cur), key,
+		keylen, false);
+	    break;
 	}
     }
 
     return success;
 }
+
+/*
+ * Merge the keys of elt into top in one pass over elt.  Where a key is on
+ * both sides, the policy decides: objects are merged key by key unless it
+ * is replace, and otherwise error fails, replace and merge overwrite (merge
+ * concatenates two arrays) and append collects both values in an array.
+ * Any object of elt may set the policy for itself and what is below it
+ * with a .merge key.
+ */
+bool
+merge_recursive(ucl_object_t *top, const ucl_object_t *elt,
+    enum merge_policy policy)
+{
+    int p;
+
+    p = merge_policy_of(elt, policy);
+    if (p == -1) {
+	return false;
+    }
+
+    return merge_tree(top, elt, p);
+}
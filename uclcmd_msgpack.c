@@ -0,0 +1,233 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+/*
+ * Raw msgpack helpers
+ *
+ * These walk encoded msgpack without building any objects, to find where
+ * one value ends in a stream of concatenated records.
+ */
+
+#include "uclcmd.h"
+
+/* Read an n byte big endian unsigned integer */
+uint64_t
+msgpack_be(const unsigned char *p, size_t n)
+{
+    uint64_t val = 0;
+
+    while (n-- > 0) {
+	val = (val << 8) | *p++;
+    }
+
+    return val;
+}
+
+/*
+ * Return the encoded size of the msgpack value at the start of data, 0 if
+ * it continues beyond len, or -1 if it is not valid msgpack.
+ */
+ssize_t
+msgpack_skip(const unsigned char *data, size_t len)
+{
+    uint64_t need = 1;		/* values left to skip */
+    uint64_t n;
+    size_t pos = 0, lenbytes, extra;
+    unsigned char c;
+
+    while (need > 0) {
+	if (pos >= len) {
+	    return 0;
+	}
+	c = data[pos++];
+	need--;
+	lenbytes = 0;
+	extra = 0;
+	if (c <= 0x7f || c >= 0xe0) {
+	    /* positive or negative fixint */
+	    continue;
+	} else if (c <= 0x8f) {
+	    need += 2 * (uint64_t)(c & 0x0f);
+	    continue;
+	} else if (c <= 0x9f) {
+	    need += c & 0x0f;
+	    continue;
+	} else if (c <= 0xbf) {
+	    extra = c & 0x1f;
+	} else {
+	    switch (c) {
+	    case 0xc0:	/* nil */
+	    case 0xc2:	/* false */
+	    case 0xc3:	/* true */
+		continue;
+	    case 0xc4:	/* bin 8 */
+	    case 0xd9:	/* str 8 */
+		lenbytes = 1;
+		break;
+	    case 0xc5:	/* bin 16 */
+	    case 0xda:	/* str 16 */
+		lenbytes = 2;
+		break;
+	    case 0xc6:	/* bin 32 */
+	    case 0xdb:	/* str 32 */
+		lenbytes = 4;
+		break;
+	    case 0xc7:	/* ext 8, 16, 32 have a type byte after the length */
+		lenbytes = 1;
+		extra = 1;
+		break;
+	    case 0xc8:
+		lenbytes = 2;
+		extra = 1;
+		break;
+	    case 0xc9:
+		lenbytes = 4;
+		extra = 1;
+		break;
+	    case 0xcc:	/* uint 8 */
+	    case 0xd0:	/* int 8 */
+		extra = 1;
+		break;
+	    case 0xcd:
+	    case 0xd1:
+		extra = 2;
+		break;
+	    case 0xca:	/* float 32 */
+	    case 0xce:
+	    case 0xd2:
+		extra = 4;
+		break;
+	    case 0xcb:	/* float 64 */
+	    case 0xcf:
+	    case 0xd3:
+		extra = 8;
+		break;
+	    case 0xd4:	/* fixext 1, 2, 4, 8, 16 plus the type byte */
+		extra = 2;
+		break;
+	    case 0xd5:
+		extra = 3;
+		break;
+	    case 0xd6:
+		extra = 5;
+		break;
+	    case 0xd7:
+		extra = 9;
+		break;
+	    case 0xd8:
+		extra = 17;
+		break;
+	    case 0xdc:	/* array 16, 32 */
+	    case 0xdd:
+	    case 0xde:	/* map 16, 32 */
+	    case 0xdf:
+		lenbytes = (c & 1) ? 4 : 2;
+		if (len - pos < lenbytes) {
+		    return 0;
+		}
+		n = msgpack_be(data + pos, lenbytes);
+		pos += lenbytes;
+		need += (c >= 0xde) ? 2 * n : n;
+		continue;
+	    default:	/* 0xc1 is never used */
+		return -1;
+	    }
+	}
+	if (lenbytes > 0) {
+	    if (len - pos < lenbytes) {
+		return 0;
+	    }
+	    extra += msgpack_be(data + pos, lenbytes);
+	    pos += lenbytes;
+	}
+	if (len - pos < extra) {
+	    return 0;
+	}
+	pos += extra;
+    }
+
+    return pos;
+}
+
+/*
+ * Decode the header of the map, array or string at the start of data.  The
+ * type is returned in *type and the number of pairs, elements or bytes in
+ * *count.  Returns the size of the header, or 0 if data holds some other
+ * type or is too short.
+ */
+size_t
+msgpack_header(const unsigned char *data, size_t len, ucl_type_t *type,
+    uint64_t *count)
+{
+    size_t lenbytes;
+    unsigned char c;
+
+    if (len == 0) {
+	return 0;
+    }
+    c = data[0];
+    if (c >= 0x80 && c <= 0x8f) {
+	*type = UCL_OBJECT;
+	*count = c & 0x0f;
+	return 1;
+    } else if (c >= 0x90 && c <= 0x9f) {
+	*type = UCL_ARRAY;
+	*count = c & 0x0f;
+	return 1;
+    } else if (c >= 0xa0 && c <= 0xbf) {
+	*type = UCL_STRING;
+	*count = c & 0x1f;
+	return 1;
+    }
+    switch (c) {
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+	*type = UCL_STRING;
+	lenbytes = 1 << (c - 0xd9);
+	break;
+    case 0xdc:
+    case 0xdd:
+	*type = UCL_ARRAY;
+	lenbytes = (c & 1) ? 4 : 2;
+	break;
+    case 0xde:
+    case 0xdf:
+	*type = UCL_OBJECT;
+	lenbytes = (c & 1) ? 4 : 2;
+	break;
+    default:
+	return 0;
+    }
+    if (len - 1 < lenbytes) {
+	return 0;
+    }
+    *count = msgpack_be(data + 1, lenbytes);
+
+    return 1 + lenbytes;
+}
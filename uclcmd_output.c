@@ -28,6 +28,397 @@
 
 #include "uclcmd.h"
 
+/*
+ * Output buffer
+ *
+ * Text output is formatted into a large buffer and written to the output
+ * descriptor when it fills, rather than one fprintf() per token.  Anything
+ * written to output through stdio must call output_flush() first.
+ */
+#define	OUTBUF_SIZE	(256 * 1024)
+
+static char outbuf[OUTBUF_SIZE];
+static size_t outlen = 0;
+
+static void
+output_writev(struct iovec *iov, int iovcnt)
+{
+    ssize_t done;
+
+    fflush(output);
+    while (iovcnt > 0) {
+	done = writev(fileno(output), iov, iovcnt);
+	if (done < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "Error: could not write output: %s\n",
+		strerror(errno));
+	    outlen = 0;
+	    exit(7);
+	}
+	while (iovcnt > 0 && (size_t)done >= iov->iov_len) {
+	    done -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + done;
+	    iov->iov_len -= done;
+	}
+    }
+}
+
+void
+output_flush(void)
+{
+    struct iovec iov;
+
+    if (outlen == 0) {
+	return;
+    }
+    iov.iov_base = outbuf;
+    iov.iov_len = outlen;
+    outlen = 0;
+    output_writev(&iov, 1);
+}
+
+void
+output_write(const void *data, size_t len)
+{
+    struct iovec iov[2];
+
+    if (len <= OUTBUF_SIZE - outlen) {
+	memcpy(outbuf + outlen, data, len);
+	outlen += len;
+	return;
+    }
+    if (len < OUTBUF_SIZE / 2) {
+	output_flush();
+	memcpy(outbuf, data, len);
+	outlen = len;
+	return;
+    }
+    /* Large writes go out together with the buffer, without a copy */
+    iov[0].iov_base = outbuf;
+    iov[0].iov_len = outlen;
+    iov[1].iov_base = __DECONST(void *, data);
+    iov[1].iov_len = len;
+    outlen = 0;
+    output_writev(iov, 2);
+}
+
+void
+output_char(char c)
+{
+    if (outlen == OUTBUF_SIZE) {
+	output_flush();
+    }
+    outbuf[outlen++] = c;
+}
+
+void
+output_str(const char *str)
+{
+    output_write(str, strlen(str));
+}
+
+/*
+ * Write str as a quoted JSON string
+ */
+void
+output_json_string(const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *start = str, *end = str + len;
+    unsigned char c;
+
+    output_char('"');
+    for (; str < end; str++) {
+	c = *str;
+	if (c >= 0x20 && c != '"' && c != '\\') {
+	    continue;
+	}
+	output_write(start, str - start);
+	start = str + 1;
+	output_char('\\');
+	switch (c) {
+	case '"':
+	case '\\':
+	    output_char(c);
+	    break;
+	case '\n':
+	    output_char('n');
+	    break;
+	case '\r':
+	    output_char('r');
+	    break;
+	case '\t':
+	    output_char('t');
+	    break;
+	default:
+	    output_str("u00");
+	    output_char(hex[c >> 4]);
+	    output_char(hex[c & 0xf]);
+	    break;
+	}
+    }
+    output_write(start, end - start);
+    output_char('"');
+}
+
+/*
+ * Write a node path, followed by suffix unless it is 0
+ */
+void
+output_path(const nodepath_t *path, char suffix)
+{
+    output_write(path->buf, path->len);
+    if (suffix != 0) {
+	output_char(suffix);
+    }
+}
+
+void
+output_int(intmax_t val)
+{
+    char num[24], *p = num + sizeof(num);
+    uintmax_t uval = val;
+
+    if (val < 0) {
+	uval = -uval;
+    }
+    do {
+	*--p = '0' + uval % 10;
+	uval /= 10;
+    } while (uval != 0);
+    if (val < 0) {
+	*--p = '-';
+    }
+    output_write(p, num + sizeof(num) - p);
+}
+
+/*
+ * Same as printf("%f").  When val * 10^6 is an integer below 2^52 the
+ * product is exact enough that printing its digits rounds the same way.
+ */
+void
+output_float(double val)
+{
+    char num[32], *p = num + sizeof(num);
+    double scaled = val * 1e6;
+    uintmax_t uval;
+    int i;
+
+    if (!(fabs(scaled) < 4503599627370496.0) || scaled != floor(scaled)) {
+	i = snprintf(num, sizeof(num), "%f", val);
+	if (i >= 0 && (size_t)i < sizeof(num)) {
+	    output_write(num, i);
+	} else {
+	    output_flush();
+	    fprintf(output, "%f", val);
+	}
+	return;
+    }
+    uval = (uintmax_t)fabs(scaled);
+    for (i = 0; i < 6; i++) {
+	*--p = '0' + uval % 10;
+	uval /= 10;
+    }
+    *--p = '.';
+    do {
+	*--p = '0' + uval % 10;
+	uval /= 10;
+    } while (uval != 0);
+    if (signbit(val)) {
+	*--p = '-';
+    }
+    output_write(p, num + sizeof(num) - p);
+}
+
+/*
+ * Emitter callbacks, so that libucl emits straight into the output buffer
+ * rather than rendering the whole subtree into memory first.  Doubles are
+ * formatted the same way as ucl_object_emit_memory_funcs() does.
+ */
+static unsigned char emit_last = '\0';
+
+static int
+emit_char(unsigned char c, size_t nchars, void *ud)
+{
+    while (nchars-- > 0) {
+	output_char(c);
+	emit_last = c;
+    }
+    return 0;
+}
+
+static int
+emit_len(const unsigned char *str, size_t len, void *ud)
+{
+    if (len > 0) {
+	output_write(str, len);
+	emit_last = str[len - 1];
+    }
+    return 0;
+}
+
+static int
+emit_int(int64_t val, void *ud)
+{
+    output_int(val);
+    emit_last = '0';
+    return 0;
+}
+
+static int
+emit_double(double val, void *ud)
+{
+    const double delta = 0.0000001;
+    char num[64];
+    int len;
+
+    if (val == (double)(int)val) {
+	len = snprintf(num, sizeof(num), "%.1lf", val);
+	output_write(num, len);
+    } else if (fabs(val - (double)(int)val) < delta) {
+	len = snprintf(num, sizeof(num), "%.*lg", DBL_DIG, val);
+	output_write(num, len);
+    } else {
+	output_float(val);
+    }
+    emit_last = '0';
+    return 0;
+}
+
+static struct ucl_emitter_functions output_emitter = {
+    .ucl_emitter_append_character = emit_char,
+    .ucl_emitter_append_len = emit_len,
+    .ucl_emitter_append_int = emit_int,
+    .ucl_emitter_append_double = emit_double,
+    .ucl_emitter_free_func = NULL,
+    .ud = NULL
+};
+
+/*
+ * Emit obj in the current output_type.  Returns true if the output ended
+ * with a newline.
+ */
+bool
+output_emit(const ucl_object_t *obj, enum ucl_emitter type,
+    const ucl_object_t *comments)
+{
+    if (obj == NULL) {
+	/* What printing the NULL result of ucl_object_emit() gave */
+	output_str("(null)");
+	return false;
+    }
+    emit_last = '\0';
+    ucl_object_emit_full(obj, type, &output_emitter, comments);
+
+    return emit_last == '\n';
+}
+
+/*
+ * Framed msgpack output: each value is emitted into a scratch buffer, that
+ * is reused across values, and written after its length as a 32 bit big
+ * endian integer.  A missing value is written as msgpack nil.
+ */
+static struct {
+    unsigned char *buf;
+    size_t len;
+    size_t size;
+} frame;
+
+static void
+frame_write(const void *data, size_t len)
+{
+    if (frame.len + len > frame.size) {
+	if (frame.size == 0) {
+	    frame.size = 64 * 1024;
+	}
+	while (frame.len + len > frame.size) {
+	    frame.size *= 2;
+	}
+	frame.buf = realloc(frame.buf, frame.size);
+	if (frame.buf == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		ENOMEM);
+	    abort();
+	}
+    }
+    memcpy(frame.buf + frame.len, data, len);
+    frame.len += len;
+}
+
+static int
+frame_char(unsigned char c, size_t nchars, void *ud)
+{
+    while (nchars-- > 0) {
+	frame_write(&c, 1);
+    }
+    return 0;
+}
+
+static int
+frame_len(const unsigned char *str, size_t len, void *ud)
+{
+    frame_write(str, len);
+    return 0;
+}
+
+/* The msgpack emitter encodes numbers itself, these are not reached */
+static int
+frame_int(int64_t val, void *ud)
+{
+    char num[32];
+
+    frame_write(num, snprintf(num, sizeof(num), "%jd", (intmax_t)val));
+    return 0;
+}
+
+static int
+frame_double(double val, void *ud)
+{
+    char num[64];
+
+    frame_write(num, snprintf(num, sizeof(num), "%f", val));
+    return 0;
+}
+
+static struct ucl_emitter_functions frame_emitter = {
+    .ucl_emitter_append_character = frame_char,
+    .ucl_emitter_append_len = frame_len,
+    .ucl_emitter_append_int = frame_int,
+    .ucl_emitter_append_double = frame_double,
+    .ucl_emitter_free_func = NULL,
+    .ud = NULL
+};
+
+void
+output_framed(const ucl_object_t *obj)
+{
+    unsigned char hdr[4];
+
+    frame.len = 0;
+    if (obj != NULL) {
+	ucl_object_emit_full(obj, UCL_EMIT_MSGPACK, &frame_emitter, NULL);
+    } else {
+	frame_write("\xc0", 1);
+    }
+    if (frame.len > UINT32_MAX) {
+	fprintf(stderr, "Error: value too large to frame: %zu bytes\n",
+	    frame.len);
+	cleanup();
+	exit(1);
+    }
+    hdr[0] = frame.len >> 24;
+    hdr[1] = frame.len >> 16;
+    hdr[2] = frame.len >> 8;
+    hdr[3] = frame.len;
+    output_write(hdr, sizeof(hdr));
+    output_write(frame.buf, frame.len);
+}
+
 int
 output_main(int argc, char *argv[])
 {
@@ -39,6 +430,7 @@ output_main(int argc, char *argv[])
 	{ "file",	required_argument,	NULL,		'f' },
 	{ "input",	no_argument,		NULL,		'i' },
 	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
 	{ NULL,		0,			NULL,		0 }
     };
 
@@ -54,6 +446,9 @@ output_main(int argc, char *argv[])
 	case 'I':
 	    pflags |= UCL_PARSER_KEY_LOWERCASE;
 	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
 	default:
 	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
 	    usage();
@@ -81,117 +476,114 @@ output_main(int argc, char *argv[])
 }
 
 void
-output_chunk(const ucl_object_t *obj, char *nodepath, const char *inkey)
+output_chunk(const ucl_object_t *obj, const nodepath_t *path, size_t keymark)
 {
-    unsigned char *result = NULL;
-    char *key = strdup(inkey);
-    ucl_object_t *comments;
-    struct ucl_emitter_functions *func;
+    /* The path ends in a key of its own, rather than just a node path */
+    bool haskey = path->len > keymark;
+    ucl_object_t *comments, *canon = NULL;
     bool hasnewline = false;
 
-    if (shvars == true) {
-	replace_sep(nodepath, '.', '_');
+    /* Emit a sorted, normalized copy; the text output has no key order */
+    if (canonical && obj != NULL && output_type != 254) {
+	obj = canon = canonical_copy(obj);
     }
-    replace_sep(nodepath, input_sepchar, output_sepchar);
-    replace_sep(key, input_sepchar, output_sepchar);
 
     switch (output_type) {
     case 254: /* Text */
-	output_key(obj, nodepath, key);
+	output_key(obj, path);
 	break;
     case UCL_EMIT_CONFIG: /* UCL */
 #if 0
 	comments = ucl_object_ref(ucl_parser_get_comments(parser));
 #else
-	comments = NULL;
+	/* Set by compile --annotate */
+	comments = annotations;
 #endif
-	result = NULL;
-	func = ucl_object_emit_memory_funcs((void **)&result);
-	if (func != NULL) {
-	    if (obj != NULL) {
-		ucl_object_emit_full(obj, output_type, func, comments);
-	    }
-	    ucl_object_emit_funcs_free(func);
-	}
 	if (nonewline) {
 	    fprintf(stderr, "WARN: UCL output cannot be 'nonewline'd\n");
 	}
-	if (show_keys == 1 && key && strlen(key) > 0) {
-	    fprintf(output, "%s%s=", nodepath, key);
+	if (show_keys == 1 && haskey) {
+	    output_path(path, '=');
 	}
-	if (result && result[strlen((char *)result) - 1] == '\n') {
-	    hasnewline = true;
-	}
-	fprintf(output, "%s", result);
-	free(result);
+	hasnewline = output_emit(obj, output_type, comments);
 	if (nonewline) {
 	    firstline = false;
 	} else if (hasnewline == false) {
-	    fprintf(output, "\n");
+	    output_char('\n');
 	}
 	break;
     case UCL_EMIT_JSON: /* JSON */
-	result = ucl_object_emit(obj, output_type);
 	if (nonewline) {
 	    fprintf(stderr,
 		"WARN: non-compact JSON output cannot be 'nonewline'd\n");
 	}
-	if (show_keys == 1 && key && strlen(key) > 0) {
-	    fprintf(output, "%s%s=", nodepath, key);
-	}
-	if (result && result[strlen((char *)result) - 1] == '\n') {
-	    hasnewline = true;
+	if (show_keys == 1 && haskey) {
+	    output_path(path, '=');
 	}
-	fprintf(output, "%s", result);
-	free(result);
+	hasnewline = output_emit(obj, output_type, NULL);
 	if (nonewline) {
 	    firstline = false;
 	} else if (hasnewline == false) {
-	    fprintf(output, "\n");
+	    output_char('\n');
 	}
 	break;
     case UCL_EMIT_JSON_COMPACT: /* Compact JSON */
-	result = ucl_object_emit(obj, output_type);
-	if (show_keys == 1 && key && strlen(key) > 0)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "%s", result);
-	free(result);
+	if (show_keys == 1 && haskey)
+	    output_path(path, '=');
+	output_emit(obj, output_type, NULL);
 	if (nonewline) {
 	    firstline = false;
-	} else if (hasnewline == false) {
-	    fprintf(output, "\n");
+	} else {
+	    output_char('\n');
 	}
 	break;
     case UCL_EMIT_YAML: /* YAML */
-	result = ucl_object_emit(obj, output_type);
 	if (nonewline) {
 	    fprintf(stderr, "WARN: YAML output cannot be 'nonewline'd\n");
 	}
-	if (show_keys == 1 && key && strlen(key) > 0) {
-	    fprintf(output, "%s%s=", nodepath, key);
+	if (show_keys == 1 && haskey) {
+	    output_path(path, '=');
 	}
-	fprintf(output, "%s", result);
-	free(result);
+	output_emit(obj, output_type, NULL);
 	if (nonewline) {
 	    firstline = false;
-	} else if (hasnewline == false) {
-	    fprintf(output, "\n");
+	} else {
+	    output_char('\n');
 	}
 	break;
+    case UCLCMD_EMIT_NDJSON: /* One compact JSON document per line */
+	if (nonewline) {
+	    fprintf(stderr, "WARN: NDJSON output cannot be 'nonewline'd\n");
+	}
+	if (show_keys == 1) {
+	    output_str("{\"path\":");
+	    output_json_string(path->buf, path->len);
+	    output_str(",\"value\":");
+	}
+	if (obj != NULL) {
+	    output_emit(obj, UCL_EMIT_JSON_COMPACT, NULL);
+	} else {
+	    output_str("null");
+	}
+	if (show_keys == 1) {
+	    output_char('}');
+	}
+	output_char('\n');
+	break;
     case UCL_EMIT_MSGPACK: /* Msgpack */
-	result = ucl_object_emit(obj, output_type);
+	/* Binary output, write exactly what was emitted and no newline */
 	if (nonewline) {
 	    fprintf(stderr, "WARN: Msgpack output cannot be 'nonewline'd\n");
 	}
-	if (show_keys == 1 && key && strlen(key) > 0) {
-	    fprintf(output, "%s%s=", nodepath, key);
+	if (framed) {
+	    output_framed(obj);
+	    break;
 	}
-	fprintf(output, "%s", result);
-	free(result);
-	if (nonewline) {
-	    firstline = false;
-	} else if (hasnewline == false) {
-	    fprintf(output, "\n");
+	if (show_keys == 1 && haskey) {
+	    output_path(path, '=');
+	}
+	if (obj != NULL) {
+	    output_emit(obj, output_type, NULL);
 	}
 	break;
     default:
@@ -199,8 +591,7 @@ output_chunk(const ucl_object_t *obj, char *nodepath, const char *inkey)
 	    output_type);
 	break;
     }
-
-    free(key);
+    ucl_object_unref(canon);
 }
 
 FILE *
@@ -240,8 +631,7 @@ output_close(FILE *out)
 }
 
 int
-replace_file(const ucl_object_t *obj, char *nodepath, const char *inkey,
-    const char *output_filename)
+replace_file(const ucl_object_t *obj, const char *output_filename)
 {
     int success = 0, fd;
     char *tmp_filename;
@@ -283,9 +673,11 @@ replace_file(const ucl_object_t *obj, char *nodepath, const char *inkey,
 	fchmod(fd, fst.st_mode);
     }
     
+    output_flush();
     output = out;
 
-    output_chunk(obj, nodepath, inkey);
+    output_chunk(obj, &nodepath_root, 0);
+    output_flush();
 
     /* Make sure everything is on disk */
     success = fsync(fd);
@@ -304,35 +696,26 @@ replace_file(const ucl_object_t *obj, char *nodepath, const char *inkey,
 	cleanup();
 	exit(7);
     }
+    index_refresh(output_filename);
 
     return success;
 }
 
 void
-output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
+output_key(const ucl_object_t *obj, const nodepath_t *path)
 {
-    char *key;
-
-    if (inkey == NULL) {
-	uclcmd_asprintf(&key, "");
-    } else {
-	key = strdup(inkey);
-    }
-
-    replace_sep(nodepath, input_sepchar, output_sepchar);
-    replace_sep(key, input_sepchar, output_sepchar);
     if (firstline == false) {
-	fprintf(output, " ");
+	output_char(' ');
     }
     if (obj == NULL) {
 	if (show_keys == 1) {
-	    fprintf(output, "%s%s=", nodepath, key);
+	    output_path(path, '=');
 	}
-	fprintf(output, "null");
+	output_str("null");
 	if (nonewline) {
 	    firstline = false;
 	} else {
-	    fprintf(output, "\n");
+	    output_char('\n');
 	}
 	return;
     }
@@ -343,8 +726,8 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		"value={object}\n", obj->key, obj->len);
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "{object}");
+	    output_path(path, '=');
+	output_str("{object}");
 	break;
     case UCL_ARRAY:
 	if (debug >= 3) {
@@ -352,8 +735,8 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		"value=[array]\n", obj->key, obj->len);
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "[array]");
+	    output_path(path, '=');
+	output_str("[array]");
 	break;
     case UCL_INT:
 	if (debug >= 3) {
@@ -361,8 +744,8 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		obj->key, obj->len, (intmax_t)ucl_object_toint(obj));
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "%jd", (intmax_t)ucl_object_toint(obj));
+	    output_path(path, '=');
+	output_int(ucl_object_toint(obj));
 	break;
     case UCL_FLOAT:
 	if (debug >= 3) {
@@ -370,8 +753,12 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		obj->key, obj->len, ucl_object_todouble(obj));
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "%f", ucl_object_todouble(obj));
+	    output_path(path, '=');
+	if (canonical) {
+	    output_float(canonical_double(ucl_object_todouble(obj)));
+	} else {
+	    output_float(ucl_object_todouble(obj));
+	}
 	break;
     case UCL_STRING:
 	if (debug >= 3) {
@@ -379,11 +766,14 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		"value=\"%s\"\n", obj->key, obj->len, ucl_object_tostring(obj));
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	if (show_raw == 1)
-	    fprintf(output, "%s", ucl_object_tostring(obj));
-	else
-	    fprintf(output, "\"%s\"", ucl_object_tostring(obj));
+	    output_path(path, '=');
+	if (show_raw == 1) {
+	    output_str(ucl_object_tostring(obj));
+	} else {
+	    output_char('"');
+	    output_str(ucl_object_tostring(obj));
+	    output_char('"');
+	}
 	break;
     case UCL_BOOLEAN:
 	if (debug >= 3) {
@@ -392,8 +782,8 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		ucl_object_tostring_forced(obj));
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "%s", ucl_object_tostring_forced(obj));
+	    output_path(path, '=');
+	output_str(ucl_object_tostring_forced(obj));
 	break;
     case UCL_TIME:
 	if (debug >= 3) {
@@ -401,8 +791,12 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		obj->key, obj->len, ucl_object_todouble(obj));
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "%f", ucl_object_todouble(obj));
+	    output_path(path, '=');
+	if (canonical) {
+	    output_float(canonical_double(ucl_object_todouble(obj)));
+	} else {
+	    output_float(ucl_object_todouble(obj));
+	}
 	break;
     case UCL_USERDATA:
 	if (debug >= 3) {
@@ -410,12 +804,12 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
 		"value=%p\n", obj->key, obj->len, obj->value.ud);
 	}
 	if (show_keys == 1)
-	    fprintf(output, "%s%s=", nodepath, key);
-	fprintf(output, "{userdata}");
+	    output_path(path, '=');
+	output_str("{userdata}");
 	break;
     default:
 	if (debug >= 3) {
-	    fprintf(output, "error=Object of unknown type\n");
+	    output_str("error=Object of unknown type\n");
 	    fprintf(stderr, "DEBUG: key=%s\nlen=%u\ntype=UCL_ERROR\n"
 		"value=null\n", obj->key, obj->len);
 	}
@@ -424,10 +818,8 @@ output_key(const ucl_object_t *obj, char *nodepath, const char *inkey)
     if (nonewline) {
 	firstline = false;
     } else {
-	fprintf(output, "\n");
+	output_char('\n');
     }
-
-    free(key);
 }
 
 void
@@ -438,6 +830,8 @@ ucl_obj_dump(const ucl_object_t *obj, unsigned int shift)
     const ucl_object_t *cur, *cur2;
     ucl_object_iter_t it = NULL, it2 = NULL;
 
+    /* The dump goes to stdout through stdio */
+    output_flush();
     it = ucl_object_iterate_new(obj);
     it2 = ucl_object_iterate_new(obj);
 
@@ -500,4 +894,5 @@ ucl_obj_dump(const ucl_object_t *obj, unsigned int shift)
 
     ucl_object_iterate_free (it);
     free (pre);
+    fflush(stdout);
 }
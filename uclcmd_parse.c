@@ -28,45 +28,376 @@
 
 #include "uclcmd.h"
 
+/*
+ * Decide how to parse a buffer.  Text UCL/JSON never starts with a byte in
+ * 0x80-0x9f (those are UTF-8 continuation bytes) and realistically never
+ * with 0xdc-0xdf, while those are exactly the msgpack map and array markers.
+ */
+enum ucl_parse_type
+detect_input_format(const unsigned char *data, size_t len)
+{
+
+    if (input_format != UCL_PARSE_AUTO) {
+	return input_format;
+    }
+    if (len > 0 && ((data[0] >= 0x80 && data[0] <= 0x9f) ||
+	    (data[0] >= 0xdc && data[0] <= 0xdf))) {
+	return UCL_PARSE_MSGPACK;
+    }
+
+    return UCL_PARSE_UCL;
+}
+
+bool
+parse_chunk(struct ucl_parser *parser, const unsigned char *data, size_t len,
+    enum ucl_parse_type type)
+{
+
+    if (debug > 0 && type == UCL_PARSE_MSGPACK) {
+	fprintf(stderr, "DEBUG: Parsing %zu bytes as msgpack\n", len);
+    }
+    return ucl_parser_add_chunk_full(parser, data, len, 0,
+	UCL_DUPLICATE_APPEND, type);
+}
+
+enum ucl_parse_type
+string_to_format(const char *strformat)
+{
+
+    if (strcasecmp(strformat, "msgpack") == 0) {
+	return UCL_PARSE_MSGPACK;
+    } else if (strcasecmp(strformat, "ucl") == 0 ||
+	    strcasecmp(strformat, "json") == 0) {
+	return UCL_PARSE_UCL;
+    } else if (strcasecmp(strformat, "auto") != 0) {
+	fprintf(stderr, "Error: Unknown input format: %s\n", strformat);
+	usage();
+    }
+
+    return UCL_PARSE_AUTO;
+}
+
 ucl_object_t*
 parse_file(struct ucl_parser *parser, const char *filename)
 {
     ucl_object_t *obj = NULL;
+    int error = 0;
+
+    /* uclcmd serve keeps resident trees, don't parse those again */
+    obj = serve_lookup(filename);
+    if (obj != NULL) {
+	return obj;
+    }
+
+    obj = parse_file_common(parser, filename, &error);
+    if (error != 0) {
+	cleanup();
+	exit(error);
+    }
+
+    return obj;
+}
+
+/*
+ * Parse a file without exiting on failure: errors are reported on stderr,
+ * NULL is returned and *error holds the exit code parse_file() would use.
+ */
+ucl_object_t*
+parse_file_common(struct ucl_parser *parser, const char *filename, int *error)
+{
+    ucl_object_t *obj = NULL;
+    unsigned char *map = NULL, *buf = NULL, *data = NULL;
+    char realbuf[PATH_MAX];
+    size_t len = 0;
     bool success = false;
+    struct stat st;
+    struct rusage ru;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+	fprintf(stderr, "Error occured: cannot open file %s: %s\n",
+	    filename, strerror(errno));
+	*error = 2;
+	return NULL;
+    }
 
-    success = ucl_parser_add_file(parser, filename);
+    /*
+     * Regular files are parsed straight out of the page cache, anything
+     * else (pipes, devices, /dev/stdin) has to be read into memory
+     */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+	    map = NULL;
+	} else {
+	    len = st.st_size;
+	    (void)madvise(map, len, MADV_SEQUENTIAL);
+	}
+    }
+    if (map == NULL) {
+	buf = read_input(fd, &len);
+    }
+    close(fd);
+
+    /* Let includes resolve relative to the file, as ucl_parser_add_file does */
+    if (realpath(filename, realbuf) == NULL) {
+	snprintf(realbuf, sizeof(realbuf), "%s", filename);
+    }
+    ucl_parser_set_filevars(parser, realbuf, false);
+
+    data = map != NULL ? map : buf;
+    success = parse_chunk(parser, data, len, detect_input_format(data, len));
+
+    if (debug > 0) {
+	getrusage(RUSAGE_SELF, &ru);
+	if (map != NULL) {
+	    fprintf(stderr, "DEBUG: Parsed %s from a %zu byte mapping "
+		"(maxrss %ld KiB)\n", filename, len, ru.ru_maxrss);
+	} else {
+	    fprintf(stderr, "DEBUG: Parsed %s from a %zu byte buffer "
+		"(maxrss %ld KiB)\n", filename, len, ru.ru_maxrss);
+	}
+    }
+    if (map != NULL) {
+	munmap(map, len);
+    }
+    free(buf);
 
     if (!success) {
 	fprintf(stderr, "Error occured: %s\n",
 	    ucl_parser_get_error(parser));
-	cleanup();
-	exit(2);
+	*error = 2;
+	return NULL;
     }
 
     obj = ucl_parser_get_object(parser);
     if (ucl_parser_get_error(parser)) {
 	fprintf(stderr, "Error: Parse Error occured: %s\n",
 	    ucl_parser_get_error(parser));
-	cleanup();
-	exit(3);
+	ucl_object_unref(obj);
+	*error = 3;
+	return NULL;
     }
 
     return obj;
 }
 
+/*
+ * Read everything from fd into a single heap buffer, growing it
+ * geometrically so arbitrarily large input costs O(n) copies in total.
+ * The buffer is always NUL terminated, *len does not include the NUL.
+ */
+unsigned char*
+read_input(int fd, size_t *len)
+{
+    unsigned char *buf = NULL, *tmp = NULL;
+    size_t cap = 65536, used = 0;
+    ssize_t r;
+    struct stat st;
+
+    /* If we know how much is coming (redirected file), allocate it once */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	cap = st.st_size + 1;
+    }
+    buf = malloc(cap);
+    if (buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    for (;;) {
+	if (used + 1 >= cap) {
+	    cap *= 2;
+	    tmp = realloc(buf, cap);
+	    if (tmp == NULL) {
+		fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		    ENOMEM);
+		abort();
+	    }
+	    buf = tmp;
+	}
+	r = read(fd, buf + used, cap - used - 1);
+	if (r == 0) {
+	    break;
+	} else if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "Error: Failed to read input: %s\n",
+		strerror(errno));
+	    free(buf);
+	    cleanup();
+	    exit(2);
+	}
+	used += r;
+    }
+    buf[used] = '\0';
+    *len = used;
+
+    return buf;
+}
+
+/*
+ * Add arg to list.  A directory adds the *.ucl files in it and a pattern
+ * the files it matches, both in sorted order, so the result is the same
+ * from one run to the next.
+ */
+void
+filelist_add(filelist_t *list, const char *arg)
+{
+    struct stat st;
+    glob_t g;
+    char *pattern = NULL;
+    size_t k;
+    int rc;
+
+    if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+	uclcmd_asprintf(&pattern, "%s/*.ucl", arg);
+    } else if (strpbrk(arg, "*?[") != NULL) {
+	pattern = strdup(arg);
+    }
+    if (pattern == NULL) {
+	memset(&g, 0, sizeof(g));
+	g.gl_pathc = 1;
+    } else {
+	rc = glob(pattern, 0, NULL, &g);
+	if (rc != 0) {
+	    fprintf(stderr, "Error: No files match %s\n", pattern);
+	    free(pattern);
+	    cleanup();
+	    exit(1);
+	}
+    }
+    if (list->count + g.gl_pathc > (size_t)list->size) {
+	list->size = list->count + g.gl_pathc + 8;
+	list->names = realloc(list->names, list->size * sizeof(char *));
+	if (list->names == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	    abort();
+	}
+    }
+    for (k = 0; k < g.gl_pathc; k++) {
+	list->names[list->count++] = strdup(pattern != NULL ?
+	    g.gl_pathv[k] : arg);
+    }
+    if (pattern != NULL) {
+	globfree(&g);
+	free(pattern);
+    }
+}
+
+void
+filelist_free(filelist_t *list)
+{
+    int k;
+
+    for (k = 0; k < list->count; k++) {
+	free(list->names[k]);
+    }
+    free(list->names);
+    memset(list, 0, sizeof(*list));
+}
+
+struct parse_pool {
+	pthread_mutex_t	lock;
+	parse_job_t	*jobs;
+	int		njobs;
+	int		next;		/* first job not taken yet */
+};
+
+static void*
+parse_worker(void *arg)
+{
+    struct parse_pool *pool = arg;
+    struct ucl_parser *fparser;
+    parse_job_t *job;
+
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	job = pool->next < pool->njobs ? &pool->jobs[pool->next++] : NULL;
+	pthread_mutex_unlock(&pool->lock);
+	if (job == NULL) {
+	    break;
+	}
+	fparser = ucl_parser_new(job->flags);
+	job->obj = parse_file_common(fparser, job->name, &job->error);
+	ucl_parser_free(fparser);
+    }
+
+    return NULL;
+}
+
+/*
+ * Parse every job's file, each with a parser of its own, on as many threads
+ * as there are CPUs.  Exits as parse_file() would if any of them fails.
+ */
+void
+parse_files(parse_job_t *jobs, int njobs)
+{
+    struct parse_pool pool;
+    pthread_t *threads;
+    long ncpu;
+    int nthreads, k;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu < 1 ? 1 : (ncpu < njobs ? ncpu : njobs);
+    pool.jobs = jobs;
+    pool.njobs = njobs;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    if (nthreads <= 1) {
+	parse_worker(&pool);
+    } else {
+	threads = calloc(nthreads, sizeof(*threads));
+	if (threads == NULL) {
+	    fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	    abort();
+	}
+	for (k = 0; k < nthreads; k++) {
+	    if (pthread_create(&threads[k], NULL, parse_worker, &pool) != 0) {
+		/* Carry on with the threads we have */
+		break;
+	    }
+	}
+	if (k == 0) {
+	    parse_worker(&pool);
+	}
+	nthreads = k;
+	for (k = 0; k < nthreads; k++) {
+	    pthread_join(threads[k], NULL);
+	}
+	free(threads);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Parsed %d files on %d threads\n", njobs,
+	    nthreads < 1 ? 1 : nthreads);
+    }
+
+    for (k = 0; k < njobs; k++) {
+	if (jobs[k].error != 0) {
+	    cleanup();
+	    exit(jobs[k].error);
+	}
+    }
+}
+
 ucl_object_t*
 parse_input(struct ucl_parser *parser, FILE *source)
 {
-    unsigned char inbuf[8192];
-    char *data = NULL;
-    int r = 0;
+    unsigned char *inbuf = NULL;
+    size_t r = 0;
     ucl_object_t *obj = NULL;
+    enum ucl_parse_type type;
     bool success = false;
 
-    while (!feof(source) && r < (int)sizeof(inbuf)) {
-	r += fread(inbuf + r, 1, sizeof(inbuf) - r, source);
+    inbuf = read_input(fileno(source), &r);
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Read %zu bytes of input\n", r);
     }
-    success = ucl_parser_add_chunk(parser, inbuf, r);
+    type = detect_input_format(inbuf, r);
+    success = parse_chunk(parser, inbuf, r, type);
     fclose(source);
 
     if (!success) {
@@ -80,11 +411,16 @@ parse_input(struct ucl_parser *parser, FILE *source)
 	        ucl_parser_get_error(parser));
 	    break;
 	case UCL_ESYNTAX:
+	    if (type != UCL_PARSE_UCL) {
+		fprintf(stderr, "Error: Parse Error occured: %s\n",
+		    ucl_parser_get_error(parser));
+		break;
+	    }
 	    /* The input was not a valid UCL object, treat is as a string */
 	    ucl_parser_clear_error(parser);
 	    success = true;
-	    uclcmd_asprintf(&data, "%s", inbuf);
-	    obj = ucl_object_fromstring_common(data, 0, UCL_STRING_PARSE);
+	    obj = ucl_object_fromstring_common((char *)inbuf, r,
+		UCL_STRING_PARSE);
 	    break;
 	default:
 	    fprintf(stderr, "Error: Parse Error occured: %s\n",
@@ -92,12 +428,14 @@ parse_input(struct ucl_parser *parser, FILE *source)
 	    break;
 	}
 	if (!success) {
+	    free(inbuf);
 	    cleanup();
 	    exit(3);
 	}
     } else {
 	obj = ucl_parser_get_object(parser);
     }
+    free(inbuf);
 
     if (ucl_parser_get_error(parser)) {
 	fprintf(stderr, "Error: Parse Error occured: %s\n",
@@ -155,3 +493,140 @@ parse_string(struct ucl_parser *parser, char *data)
 
     return obj;
 }
+
+static bool
+stream_record(const unsigned char *data, size_t len, enum ucl_parse_type type,
+    uintmax_t recno, stream_func_t callback, void *ud)
+{
+    struct ucl_parser *recparser;
+    ucl_object_t *obj;
+    size_t i;
+
+    if (type != UCL_PARSE_MSGPACK) {
+	/* Blank lines between records are not records */
+	for (i = 0; i < len && isspace(data[i]); i++)
+	    ;
+	if (i == len) {
+	    return true;
+	}
+    }
+
+    /* libucl parsers cannot be reset, each record gets a new one */
+    recparser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
+    if (!parse_chunk(recparser, data, len, type)) {
+	fprintf(stderr, "Error: record %ju: %s\n", recno,
+	    ucl_parser_get_error(recparser));
+	ucl_parser_free(recparser);
+	return false;
+    }
+    obj = ucl_parser_get_object(recparser);
+    callback(obj, ud);
+    ucl_object_unref(obj);
+    ucl_parser_free(recparser);
+
+    return true;
+}
+
+/*
+ * Read a stream of records from fd: lines of JSON/UCL, or concatenated
+ * msgpack values.  Each is parsed on its own, passed to callback and
+ * released again, so memory use is bounded by the largest record.
+ * Returns the number of records that could not be parsed.
+ */
+int
+parse_stream(int fd, stream_func_t callback, void *ud)
+{
+    unsigned char *buf, *tmp, *nl;
+    size_t size = 1024 * 1024, start = 0, end = 0, scan = 0;
+    ssize_t r, reclen;
+    enum ucl_parse_type type = UCL_PARSE_AUTO;
+    uintmax_t recno = 0;
+    bool eof = false;
+    int bad = 0;
+
+    buf = malloc(size);
+    if (buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    for (;;) {
+	if (end > start) {
+	    if (type == UCL_PARSE_AUTO) {
+		type = detect_input_format(buf + start, end - start);
+	    }
+	    reclen = 0;
+	    if (type == UCL_PARSE_MSGPACK) {
+		reclen = msgpack_skip(buf + start, end - start);
+		if (reclen < 0) {
+		    fprintf(stderr, "Error: record %ju: invalid msgpack\n",
+			recno + 1);
+		    bad++;
+		    break;
+		}
+	    } else {
+		nl = memchr(buf + scan, '\n', end - scan);
+		if (nl != NULL) {
+		    reclen = nl - (buf + start) + 1;
+		} else if (eof) {
+		    reclen = end - start;
+		} else {
+		    scan = end;
+		}
+	    }
+	    if (reclen > 0) {
+		recno++;
+		if (!stream_record(buf + start, reclen, type, recno,
+			callback, ud)) {
+		    bad++;
+		}
+		start += reclen;
+		scan = start;
+		continue;
+	    }
+	    if (eof) {
+		fprintf(stderr, "Error: record %ju: truncated msgpack\n",
+		    recno + 1);
+		bad++;
+		break;
+	    }
+	} else if (eof) {
+	    break;
+	}
+
+	/* Need more input for the current record */
+	if (start > 0) {
+	    memmove(buf, buf + start, end - start);
+	    end -= start;
+	    scan -= start;
+	    start = 0;
+	}
+	if (end == size) {
+	    size *= 2;
+	    tmp = realloc(buf, size);
+	    if (tmp == NULL) {
+		fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		    ENOMEM);
+		abort();
+	    }
+	    buf = tmp;
+	}
+	r = read(fd, buf + end, size - end);
+	if (r < 0) {
+	    if (errno == EINTR)
+		continue;
+	    fprintf(stderr, "Error: Failed to read input: %s\n",
+		strerror(errno));
+	    free(buf);
+	    cleanup();
+	    exit(2);
+	} else if (r == 0) {
+	    eof = true;
+	} else {
+	    end += r;
+	}
+    }
+    free(buf);
+
+    return bad;
+}
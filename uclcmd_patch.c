@@ -0,0 +1,639 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7386)
+ *
+ * uclcmd patch applies a whole patch document to the tree, then writes it
+ * once with replace_file(), or not at all if any operation fails or a test
+ * does not hold.  An array of operations is a JSON Patch, an object a Merge
+ * Patch.
+ *
+ * JSON Pointers are turned into ordinary node paths, separated by a byte
+ * that cannot appear in a key, so that set_mode(), remove_mode() and
+ * get_parent() do the work as they do for set, remove and batch.  The path
+ * cache is on while the operations run, and is flushed after any operation
+ * that may have freed a container.
+ */
+
+#include "uclcmd.h"
+
+/* Separates the tokens of a JSON Pointer once it is a node path */
+#define PATCH_SEP	'\037'
+
+/*
+ * Turn a JSON Pointer into a node path, unescaping ~0 and ~1.  The whole
+ * document is "".  Returns NULL (after saying why) if it is not valid.
+ */
+static char*
+patch_pointer(const char *ptr)
+{
+    char *node, *o;
+    const char *p;
+    size_t toklen = 0;
+
+    node = o = malloc(strlen(ptr) + 1);
+    if (node == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    if (*ptr != '\0' && *ptr != '/') {
+	goto invalid;
+    }
+    for (p = ptr; *p != '\0'; p++) {
+	if (*p == '/') {
+	    if (p != ptr) {
+		if (toklen == 0) {
+		    goto invalid;
+		}
+		*o++ = PATCH_SEP;
+	    }
+	    toklen = 0;
+	    continue;
+	}
+	if (*p == '~' && (p[1] == '0' || p[1] == '1')) {
+	    *o++ = p[1] == '0' ? '~' : '/';
+	    p++;
+	} else if (*p == '~' || *p == PATCH_SEP) {
+	    goto invalid;
+	} else {
+	    *o++ = *p;
+	}
+	toklen++;
+    }
+    if (p != ptr && toklen == 0) {
+	/* Empty keys can not be reached through a node path */
+	goto invalid;
+    }
+    *o = '\0';
+
+    return node;
+
+invalid:
+    fprintf(stderr, "Error: Unsupported or invalid JSON Pointer: %s\n", ptr);
+    free(node);
+    return NULL;
+}
+
+/* The last token of a node path */
+static char*
+patch_frag(char *node)
+{
+    char *frag = strrchr(node, PATCH_SEP);
+
+    return frag == NULL ? node : frag + 1;
+}
+
+/* The value at node, or NULL */
+static ucl_object_t*
+patch_resolve(char *node)
+{
+    ucl_object_t *parent;
+    char *frag;
+
+    if (*node == '\0') {
+	return root_obj;
+    }
+    parent = get_parent(node);
+    frag = patch_frag(node);
+
+    return __DECONST(ucl_object_t *, lookup_segment(parent, frag,
+	strlen(frag)));
+}
+
+/* A string member of an operation */
+static const char*
+patch_member(const ucl_object_t *op, const char *name)
+{
+    const ucl_object_t *obj = ucl_object_lookup(op, name);
+
+    if (ucl_object_type(obj) != UCL_STRING) {
+	return NULL;
+    }
+
+    return ucl_object_tostring(obj);
+}
+
+/*
+ * JSON equality for the test operation: numbers compare by value (1 is
+ * 1.0), objects regardless of key order, everything else exactly
+ */
+static bool
+patch_equal(const ucl_object_t *a, const ucl_object_t *b)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    const char *sa, *sb, *key;
+    size_t la, lb;
+    unsigned int i;
+    ucl_type_t ta, tb;
+
+    /* ucl_object_type() calls a missing value null */
+    if (a == NULL || b == NULL) {
+	return a == b;
+    }
+    ta = ucl_object_type(a);
+    tb = ucl_object_type(b);
+    if (ta == UCL_INT && tb == UCL_INT) {
+	return ucl_object_toint(a) == ucl_object_toint(b);
+    }
+    if ((ta == UCL_INT || ta == UCL_FLOAT || ta == UCL_TIME) &&
+	    (tb == UCL_INT || tb == UCL_FLOAT || tb == UCL_TIME)) {
+	return ucl_object_todouble(a) == ucl_object_todouble(b);
+    }
+    if (ta != tb) {
+	return false;
+    }
+
+    switch (ta) {
+    case UCL_STRING:
+	sa = ucl_object_tolstring(a, &la);
+	sb = ucl_object_tolstring(b, &lb);
+	return la == lb && memcmp(sa, sb, la) == 0;
+    case UCL_BOOLEAN:
+	return ucl_object_toboolean(a) == ucl_object_toboolean(b);
+    case UCL_NULL:
+	return true;
+    case UCL_ARRAY:
+	if (a->len != b->len) {
+	    return false;
+	}
+	for (i = 0; i < a->len; i++) {
+	    if (!patch_equal(ucl_array_find_index(a, i),
+		    ucl_array_find_index(b, i))) {
+		return false;
+	    }
+	}
+	return true;
+    case UCL_OBJECT:
+	if (a->len != b->len) {
+	    return false;
+	}
+	while ((cur = ucl_object_iterate(a, &it, true))) {
+	    key = ucl_object_keyl(cur, &la);
+	    if (!patch_equal(cur, ucl_object_lookup_len(b, key, la))) {
+		return false;
+	    }
+	}
+	return true;
+    default:
+	return false;
+    }
+}
+
+/* Insert obj at index of arr, moving what is there and after it up */
+static bool
+patch_array_insert(ucl_object_t *arr, ucl_object_t *obj, unsigned int index)
+{
+    ucl_object_t **moved;
+    unsigned int count = arr->len - index, k;
+
+    moved = calloc(count, sizeof(*moved));
+    if (moved == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (k = 0; k < count; k++) {
+	moved[k] = ucl_array_pop_last(arr);
+    }
+    ucl_array_append(arr, obj);
+    while (k > 0) {
+	ucl_array_append(arr, moved[--k]);
+    }
+    free(moved);
+
+    return true;
+}
+
+/* The add operation, obj is consumed */
+static bool
+patch_add(char *node, ucl_object_t *obj)
+{
+    ucl_object_t *parent;
+    char *frag, *end = NULL;
+    unsigned long index;
+
+    if (*node == '\0') {
+	ucl_object_unref(root_obj);
+	root_obj = obj;
+	pathcache_flush();
+	return true;
+    }
+    parent = get_parent(node);
+    frag = patch_frag(node);
+    if (ucl_object_type(parent) == UCL_ARRAY) {
+	if (strcmp(frag, "-") == 0) {
+	    return ucl_array_append(parent, obj);
+	}
+	index = strtoul(frag, &end, 10);
+	if (*frag == '\0' || *end != '\0' || index > parent->len) {
+	    fprintf(stderr, "Error: Index %s is out of range\n", frag);
+	    ucl_object_unref(obj);
+	    return false;
+	}
+	if (index == parent->len) {
+	    return ucl_array_append(parent, obj);
+	}
+	/* Every element after index moves up, cached paths to them are wrong */
+	pathcache_flush();
+	return patch_array_insert(parent, obj, index);
+    }
+    if (ucl_object_type(parent) != UCL_OBJECT) {
+	fprintf(stderr, "Error: No object or array to add %s to\n", frag);
+	ucl_object_unref(obj);
+	return false;
+    }
+    if (ucl_object_lookup(parent, frag) != NULL) {
+	/* What is replaced may be a container in the cache */
+	pathcache_flush();
+    }
+    set_obj = obj;
+
+    return set_mode(node, NULL, UCL_NULL);
+}
+
+/* Apply one RFC 6902 operation */
+static bool
+patch_op(const ucl_object_t *op, int opno)
+{
+    const char *name, *ptr, *from;
+    const ucl_object_t *value;
+    ucl_object_t *target, *obj;
+    char *node = NULL, *fromnode = NULL;
+    size_t fromlen;
+    bool success = false;
+
+    name = patch_member(op, "op");
+    ptr = patch_member(op, "path");
+    if (name == NULL || ptr == NULL) {
+	fprintf(stderr, "Error: Operation %d needs an op and a path\n", opno);
+	return false;
+    }
+    node = patch_pointer(ptr);
+    if (node == NULL) {
+	return false;
+    }
+    value = ucl_object_lookup(op, "value");
+    from = patch_member(op, "from");
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: patch %s %s\n", name, ptr);
+    }
+
+    /* Each operation gets a fresh parser, as set_mode() makes one */
+    if (setparser != NULL) {
+	ucl_parser_free(setparser);
+	setparser = NULL;
+    }
+
+    if (strcmp(name, "add") == 0 || strcmp(name, "replace") == 0 ||
+	    strcmp(name, "test") == 0) {
+	if (value == NULL) {
+	    fprintf(stderr, "Error: %s %s needs a value\n", name, ptr);
+	    goto out;
+	}
+    } else if (strcmp(name, "move") == 0 || strcmp(name, "copy") == 0) {
+	if (from == NULL || (fromnode = patch_pointer(from)) == NULL) {
+	    fprintf(stderr, "Error: %s %s needs a from\n", name, ptr);
+	    goto out;
+	}
+    } else if (strcmp(name, "remove") != 0) {
+	fprintf(stderr, "Error: Unknown patch operation: %s\n", name);
+	goto out;
+    }
+
+    /*
+     * Values are copied out of the patch, which keeps its own keys for
+     * them; the tree may give them others
+     */
+    if (strcmp(name, "add") == 0) {
+	success = patch_add(node, ucl_object_copy(value));
+    } else if (strcmp(name, "test") == 0) {
+	target = patch_resolve(node);
+	success = target != NULL && patch_equal(target, value);
+	if (!success) {
+	    fprintf(stderr, "Error: Test of %s failed\n", ptr);
+	}
+    } else if (patch_resolve(node) == NULL && strcmp(name, "copy") != 0 &&
+	    strcmp(name, "move") != 0) {
+	fprintf(stderr, "Error: %s does not exist\n", ptr);
+    } else if (strcmp(name, "remove") == 0) {
+	if (*node == '\0') {
+	    fprintf(stderr, "Error: The whole document can not be removed\n");
+	    goto out;
+	}
+	success = remove_mode(node);
+	pathcache_flush();
+    } else if (strcmp(name, "replace") == 0) {
+	pathcache_flush();
+	if (*node == '\0') {
+	    success = patch_add(node, ucl_object_copy(value));
+	} else {
+	    set_obj = ucl_object_copy(value);
+	    success = set_mode(node, NULL, UCL_NULL);
+	}
+    } else {
+	target = patch_resolve(fromnode);
+	if (target == NULL) {
+	    fprintf(stderr, "Error: %s does not exist\n", from);
+	    goto out;
+	}
+	if (strcmp(name, "copy") == 0) {
+	    success = patch_add(node, ucl_object_copy(target));
+	    goto out;
+	}
+	/* move */
+	fromlen = strlen(fromnode);
+	if (strncmp(node, fromnode, fromlen) == 0 &&
+		(node[fromlen] == '\0' || node[fromlen] == PATCH_SEP)) {
+	    if (node[fromlen] == '\0') {
+		/* Moving a value onto itself changes nothing */
+		success = true;
+	    } else {
+		fprintf(stderr, "Error: Can not move %s into itself\n", from);
+	    }
+	    goto out;
+	}
+	if (*fromnode == '\0') {
+	    fprintf(stderr, "Error: The whole document can not be moved\n");
+	    goto out;
+	}
+	obj = ucl_object_ref(target);
+	success = remove_mode(fromnode);
+	pathcache_flush();
+	if (success) {
+	    success = patch_add(node, obj);
+	} else {
+	    ucl_object_unref(obj);
+	}
+    }
+
+out:
+    if (set_obj != NULL) {
+	ucl_object_unref(set_obj);
+	set_obj = NULL;
+    }
+    free(node);
+    free(fromnode);
+
+    return success;
+}
+
+/*
+ * Apply an RFC 7386 merge patch to target, an object: null removes a key,
+ * an object is merged into the object already there, anything else
+ * replaces what is there
+ */
+static bool
+patch_merge(ucl_object_t *target, const ucl_object_t *patch)
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    ucl_object_t *found, *obj;
+    const char *key;
+    size_t keylen;
+    bool success = true;
+
+    while (success && (cur = ucl_object_iterate(patch, &it, false))) {
+	key = ucl_object_keyl(cur, &keylen);
+	found = __DECONST(ucl_object_t *, ucl_object_lookup_len(target, key,
+	    keylen));
+	if (ucl_object_type(cur) == UCL_NULL) {
+	    if (found != NULL) {
+		success = ucl_object_delete_keyl(target, key, keylen);
+	    }
+	    continue;
+	}
+	if (ucl_object_type(cur) == UCL_OBJECT) {
+	    if (ucl_object_type(found) == UCL_OBJECT) {
+		success = patch_merge(found, cur);
+		continue;
+	    }
+	    /* Built afresh, so that the nulls in it are dropped */
+	    obj = ucl_object_typed_new(UCL_OBJECT);
+	    success = patch_merge(obj, cur);
+	} else {
+	    obj = ucl_object_ref(cur);
+	}
+	if (found != NULL) {
+	    success = success && ucl_object_replace_key(target, obj, key,
+		keylen, true);
+	} else {
+	    success = success && ucl_object_insert_key(target, obj, key,
+		keylen, true);
+	}
+    }
+
+    return success;
+}
+
+int
+patch_main(int argc, char *argv[])
+{
+    const ucl_object_t *cur;
+    ucl_object_iter_t it = NULL;
+    struct ucl_parser *pparser;
+    ucl_object_t *patch;
+    unsigned char *doc = NULL;
+    int ret = 0, ch, fd, opno = 0;
+    size_t doclen = 0;
+    bool success = true;
+
+    /* When modifying, don't expand macros */
+    pflags |= UCL_PARSER_DISABLE_MACRO;
+
+    /* Set the default output type */
+    output_type = UCL_EMIT_CONFIG;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "canonical",	no_argument,		&canonical,	1 },
+	{ "cjson",	no_argument,		&output_type,
+	    UCL_EMIT_JSON_COMPACT },
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "file",	required_argument,	NULL,		'f' },
+	{ "json",	no_argument,		&output_type,
+	    UCL_EMIT_JSON },
+	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
+	{ "msgpack",	no_argument,		&output_type,
+	    UCL_EMIT_MSGPACK },
+	{ "noop",	no_argument,		&noop,		1 },
+	{ "output",	required_argument,	NULL,		'o' },
+	{ "ucl",	no_argument,		&output_type,
+	    UCL_EMIT_CONFIG },
+	{ "yaml",	no_argument,		&output_type,	UCL_EMIT_YAML },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "cdf:Ijmno:uy", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'c':
+	    output_type = UCL_EMIT_JSON_COMPACT;
+	    break;
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'f':
+	    filename = optarg;
+	    break;
+	case 'I':
+	    pflags |= UCL_PARSER_KEY_LOWERCASE;
+	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 'j':
+	    output_type = UCL_EMIT_JSON;
+	    break;
+	case 'm':
+	    output_type = UCL_EMIT_MSGPACK;
+	    break;
+	case 'n':
+	    noop = 1;
+	    break;
+	case 'o':
+	    outfile = optarg;
+	    output = output_open(outfile);
+	    break;
+	case 'u':
+	    output_type = UCL_EMIT_CONFIG;
+	    break;
+	case 'y':
+	    output_type = UCL_EMIT_YAML;
+	    break;
+	case 0:
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* Read the whole patch before touching anything */
+    if (argc == 0 || strcmp(argv[0], "-") == 0) {
+	if (filename == NULL || strcmp(filename, "-") == 0) {
+	    fprintf(stderr, "Error: the config (-f) and the patch can "
+		"not both come from STDIN\n");
+	    exit(1);
+	}
+	doc = read_input(STDIN_FILENO, &doclen);
+    } else {
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1) {
+	    fprintf(stderr, "Error: cannot open %s: %s\n", argv[0],
+		strerror(errno));
+	    exit(2);
+	}
+	doc = read_input(fd, &doclen);
+	close(fd);
+    }
+    pparser = ucl_parser_new(UCL_PARSER_NO_IMPLICIT_ARRAYS);
+    if (!parse_chunk(pparser, doc, doclen, UCL_PARSE_UCL) ||
+	    (patch = ucl_parser_get_object(pparser)) == NULL) {
+	fprintf(stderr, "Error: Could not parse the patch: %s\n",
+	    ucl_parser_get_error(pparser));
+	ucl_parser_free(pparser);
+	free(doc);
+	exit(2);
+    }
+    ucl_parser_free(pparser);
+    free(doc);
+
+    /* Initialize parser */
+    parser = ucl_parser_new(UCLCMD_PARSER_FLAGS | pflags);
+
+    /* Parse the original UCL */
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+	/* Input from STDIN */
+	root_obj = parse_input(parser, stdin);
+    } else {
+	root_obj = parse_file(parser, filename);
+    }
+
+    input_sepchar = PATCH_SEP;
+    pathcache_enable(true);
+    if (ucl_object_type(patch) == UCL_ARRAY) {
+	while (success && (cur = ucl_object_iterate(patch, &it, true))) {
+	    opno++;
+	    success = patch_op(cur, opno);
+	}
+	if (!success) {
+	    fprintf(stderr, "Error: patch operation %d failed, no changes "
+		"were written\n", opno);
+	}
+    } else if (ucl_object_type(patch) == UCL_OBJECT) {
+	if (ucl_object_type(root_obj) != UCL_OBJECT) {
+	    ucl_object_unref(root_obj);
+	    root_obj = ucl_object_typed_new(UCL_OBJECT);
+	}
+	success = patch_merge(root_obj, patch);
+	if (!success) {
+	    fprintf(stderr, "Error: merge patch failed, no changes were "
+		"written\n");
+	}
+    } else {
+	/* A merge patch that is not an object replaces the document */
+	ucl_object_unref(root_obj);
+	root_obj = ucl_object_ref(patch);
+    }
+    pathcache_enable(false);
+    input_sepchar = '.';
+    ucl_object_unref(patch);
+    if (!success) {
+	cleanup();
+	exit(1);
+    }
+
+    /* Then write the result exactly once */
+    if (noop == 0) {
+	if (outfile == NULL && filename != NULL) {
+	    outfile = filename;
+	    if (replace_file(root_obj, outfile) != 0) {
+		fprintf(stderr, "Error: failed to write the changes to %s\n",
+		    outfile);
+		exit(7);
+	    }
+	} else {
+	    output_chunk(root_obj, &nodepath_root, 0);
+	}
+    } else {
+	get_mode("");
+    }
+
+    cleanup();
+
+    return(ret);
+}
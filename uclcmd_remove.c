@@ -32,8 +32,6 @@ int
 remove_main(int argc, char *argv[])
 {
     int ret = 0, k = 0, ch;
-    ucl_object_t *obj_parent = NULL, *obj_child = NULL, *obj_temp = NULL;
-    bool success = false;
 
     /* When removing, don't expand macros */
     pflags |= UCL_PARSER_DISABLE_MACRO;
@@ -43,6 +41,7 @@ remove_main(int argc, char *argv[])
 
     /*	options	descriptor */
     static struct option longopts[] = {
+	{ "canonical",	no_argument,		&canonical,	1 },
 	{ "cjson",	no_argument,		&output_type,
 	    UCL_EMIT_JSON_COMPACT },
 	{ "debug",	optional_argument,	NULL,		'd' },
@@ -53,6 +52,7 @@ remove_main(int argc, char *argv[])
 	    UCL_EMIT_JSON },
 	{ "keys",	no_argument,		&show_keys,	1 },
 	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
 	{ "msgpack",	no_argument,		&output_type,
 	    UCL_EMIT_MSGPACK },
 	{ "noop",	no_argument,		&noop,		1 },
@@ -91,6 +91,9 @@ remove_main(int argc, char *argv[])
 	case 'I':
 	    pflags |= UCL_PARSER_KEY_LOWERCASE;
 	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
 	case 'j':
 	    output_type = UCL_EMIT_JSON;
 	    break;
@@ -149,55 +152,70 @@ remove_main(int argc, char *argv[])
     }
 
     for (k = 0; k < argc; k++) {
-	success = false;
+	remove_mode(argv[k]);
+    }
+    get_mode("");
+
+    cleanup();
+
+    return(ret);
+}
+
+/*
+ * Remove a single node, returns false (after saying why) if it could not be
+ */
+bool
+remove_mode(char *requested_node)
+{
+    ucl_object_t *obj_parent = NULL, *obj_child = NULL, *obj_temp = NULL;
+    bool success = false;
 
-	obj_parent = get_parent(argv[k]);
-	if (obj_parent == NULL) {
-	    fprintf(stderr, "Failed to find parent of key %s, skipping...\n", argv[k]);
-	    continue;
+    obj_parent = get_parent(requested_node);
+    if (obj_parent == NULL) {
+	fprintf(stderr, "Failed to find parent of key %s, skipping...\n",
+	    requested_node);
+	return false;
+    }
+    obj_child = get_object(requested_node);
+    if (obj_child == NULL || obj_child == obj_parent) {
+	fprintf(stderr, "Failed to find key %s, skipping...\n", requested_node);
+	return false;
+    }
+
+    /* if parent is an array, special case */
+    if (ucl_object_type(obj_parent) == UCL_ARRAY) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Attempting to removed index '%u' from '%s'\n",
+		ucl_array_index_of(obj_parent, obj_child), ucl_object_key(obj_parent));
 	}
-	obj_child = get_object(argv[k]);
-	if (obj_child == NULL || obj_child == obj_parent) {
-	    fprintf(stderr, "Failed to find key %s, skipping...\n", argv[k]);
-	    continue;
+	obj_temp = ucl_array_delete(obj_parent, obj_child);
+	if (obj_temp != NULL) {
+	    success = true;
+	    ucl_object_unref(obj_temp);
 	}
-
-	/* if parent is an array, special case */
-	if (ucl_object_type(obj_parent) == UCL_ARRAY) {
+    } else if (ucl_object_type(obj_parent) == UCL_OBJECT) {
+	if (ucl_object_key(obj_child) != NULL) {
 	    if (debug > 0) {
-		fprintf(stderr, "DEBUG: Attempting to removed index '%u' from '%s'\n",
-		    ucl_array_index_of(obj_parent, obj_child), ucl_object_key(obj_parent));
-	    }
-	    obj_temp = ucl_array_delete(obj_parent, obj_child);
-	    if (obj_temp != NULL) {
-		success = true;
-		ucl_object_unref(obj_temp);
-	    }
-	} else if (ucl_object_type(obj_parent) == UCL_OBJECT) {
-	    if (ucl_object_key(obj_child) != NULL) {
-		if (debug > 0) {
-		    fprintf(stderr, "DEBUG: Attempting to removed node '%s' from '%s'\n",
-			ucl_object_key(obj_child), ucl_object_key(obj_parent));
-		}
-		success = ucl_object_delete_key(obj_parent, ucl_object_key(obj_child));
-	    } else {
-		fprintf(stderr, "Failed to get key for '%s', skipping...\n", argv[k]);
-		continue;
+		fprintf(stderr, "DEBUG: Attempting to removed node '%s' from '%s'\n",
+		    ucl_object_key(obj_child), ucl_object_key(obj_parent));
 	    }
+	    success = ucl_object_delete_key(obj_parent, ucl_object_key(obj_child));
 	} else {
-	    fprintf(stderr, "Invalid parent object type for '%s', skipping...\n", argv[k]);
-	    continue;
-	}
-
-	if (!success) {
-	    fprintf(stderr, "Failed to remove key %s\n", argv[k]);
-	} else if (debug > 0) {
-	    fprintf(stderr, "DEBUG: Removed node %s\n", argv[k]);
+	    fprintf(stderr, "Failed to get key for '%s', skipping...\n",
+		requested_node);
+	    return false;
 	}
+    } else {
+	fprintf(stderr, "Invalid parent object type for '%s', skipping...\n",
+	    requested_node);
+	return false;
     }
-    get_mode("");
 
-    cleanup();
+    if (!success) {
+	fprintf(stderr, "Failed to remove key %s\n", requested_node);
+    } else if (debug > 0) {
+	fprintf(stderr, "DEBUG: Removed node %s\n", requested_node);
+    }
 
-    return(ret);
+    return success;
 }
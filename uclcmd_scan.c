@@ -0,0 +1,549 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Streaming extraction for get
+ *
+ * With --scan, a JSON file is not parsed as a whole.  It is walked token by
+ * token straight out of the page cache, keeping only the stack of open
+ * containers and the node of the request trie they correspond to.  Values
+ * whose key is not in the trie are skipped without being looked at beyond
+ * their brackets and strings, and the walk stops as soon as every requested
+ * path has been seen.  Only the bytes of the matched values are then handed
+ * to libucl, so the commands after a '|' still work on real objects.
+ *
+ * msgpack input is walked the same way, straight over the encoded bytes:
+ * strings are stepped over by their lengths and containers by their counts,
+ * without building any objects.  This is always done for msgpack files, as
+ * their encoding leaves nothing for libucl to interpret differently.  So
+ * that this holds for repeated keys too, which libucl gathers into an
+ * array, each map on the way is stepped through to its end and a key seen
+ * twice gives up the walk.
+ *
+ * Anything that is not plain JSON on the way to a match (comments, UCL
+ * assignments, escaped keys) makes scan_file() give up so that the caller
+ * can fall back to the full parser.  Unlike libucl, the first of several
+ * duplicate JSON keys is the one that is returned.
+ */
+
+#include "uclcmd.h"
+
+struct scan_ctx {
+	const unsigned char	*base;
+	const unsigned char	*end;
+	int			remaining;	/* terminal nodes not seen yet */
+};
+
+static const unsigned char* scan_value(struct scan_ctx *ctx,
+    const unsigned char *p, path_trie_t *node);
+
+const unsigned char*
+scan_ws(const unsigned char *p, const unsigned char *end)
+{
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+	p++;
+    }
+
+    return p;
+}
+
+/*
+ * p points just past an opening quote, return the byte after the closing one
+ */
+const unsigned char*
+scan_string(const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *q, *b;
+
+    while ((q = memchr(p, '"', end - p)) != NULL) {
+	/* The quote is escaped if an odd number of backslashes precede it */
+	for (b = q; b > p && b[-1] == '\\'; b--)
+	    ;
+	if (((q - b) & 1) == 0) {
+	    return q + 1;
+	}
+	p = q + 1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Step over one value without interpreting it.  Containers are left to
+ * structural_skip(), which only tracks strings and brackets.  Returns NULL
+ * on anything that is not JSON.
+ */
+const unsigned char*
+scan_skip(const unsigned char *p, const unsigned char *end)
+{
+
+    p = scan_ws(p, end);
+    if (p >= end) {
+	return NULL;
+    }
+    if (*p == '{' || *p == '[') {
+	return structural_skip(p, end);
+    }
+    if (*p == '"') {
+	return scan_string(p + 1, end);
+    }
+    /* Numbers, true, false and null */
+    if (!isalnum(*p) && *p != '-' && *p != '+' && *p != '.') {
+	return NULL;
+    }
+    while (p < end && (isalnum(*p) || *p == '-' || *p == '+' || *p == '.')) {
+	p++;
+    }
+
+    return p;
+}
+
+static path_trie_t*
+scan_child(path_trie_t *node, const unsigned char *key, size_t len)
+{
+    path_trie_t *child;
+
+    for (child = node->children; child != NULL; child = child->next) {
+	if (!child->scanned && child->seglen == len &&
+	    memcmp(child->seg, key, len) == 0) {
+	    return child;
+	}
+    }
+
+    return NULL;
+}
+
+/* Whether a child of node for key has been walked already */
+static bool
+scan_repeated(path_trie_t *node, const unsigned char *key, size_t len)
+{
+    path_trie_t *child;
+
+    for (child = node->children; child != NULL; child = child->next) {
+	if (child->scanned && child->seglen == len &&
+	    memcmp(child->seg, key, len) == 0) {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+/* Same rule as lookup_segment() for array indexes */
+static path_trie_t*
+scan_child_index(path_trie_t *node, unsigned long index)
+{
+    path_trie_t *child;
+    char *end = NULL;
+
+    for (child = node->children; child != NULL; child = child->next) {
+	if (!child->scanned && strtoul(child->seg, &end, 10) == index &&
+	    end == child->seg + child->seglen) {
+	    return child;
+	}
+    }
+
+    return NULL;
+}
+
+/* p points just past the '{' */
+static const unsigned char*
+scan_object(struct scan_ctx *ctx, const unsigned char *p, path_trie_t *node)
+{
+    const unsigned char *key;
+    path_trie_t *child;
+    size_t len;
+
+    p = scan_ws(p, ctx->end);
+    if (p < ctx->end && *p == '}') {
+	return p + 1;
+    }
+    for (;;) {
+	if (p >= ctx->end || *p != '"') {
+	    return NULL;
+	}
+	key = p + 1;
+	p = scan_string(key, ctx->end);
+	if (p == NULL) {
+	    return NULL;
+	}
+	len = p - 1 - key;
+	if (memchr(key, '\\', len) != NULL) {
+	    /* Leave unescaping keys to libucl */
+	    return NULL;
+	}
+	p = scan_ws(p, ctx->end);
+	if (p >= ctx->end || *p != ':') {
+	    return NULL;
+	}
+	p = scan_ws(p + 1, ctx->end);
+	child = scan_child(node, key, len);
+	if (child != NULL) {
+	    p = scan_value(ctx, p, child);
+	} else {
+	    p = scan_skip(p, ctx->end);
+	}
+	if (p == NULL || ctx->remaining == 0) {
+	    return p;
+	}
+	p = scan_ws(p, ctx->end);
+	if (p < ctx->end && *p == ',') {
+	    p = scan_ws(p + 1, ctx->end);
+	    continue;
+	}
+	if (p < ctx->end && *p == '}') {
+	    return p + 1;
+	}
+	return NULL;
+    }
+}
+
+/* p points just past the '[' */
+static const unsigned char*
+scan_array(struct scan_ctx *ctx, const unsigned char *p, path_trie_t *node)
+{
+    path_trie_t *child;
+    unsigned long index = 0;
+
+    p = scan_ws(p, ctx->end);
+    if (p < ctx->end && *p == ']') {
+	return p + 1;
+    }
+    for (;;) {
+	child = scan_child_index(node, index++);
+	if (child != NULL) {
+	    p = scan_value(ctx, p, child);
+	} else {
+	    p = scan_skip(p, ctx->end);
+	}
+	if (p == NULL || ctx->remaining == 0) {
+	    return p;
+	}
+	p = scan_ws(p, ctx->end);
+	if (p < ctx->end && *p == ',') {
+	    p = scan_ws(p + 1, ctx->end);
+	    continue;
+	}
+	if (p < ctx->end && *p == ']') {
+	    return p + 1;
+	}
+	return NULL;
+    }
+}
+
+/*
+ * Descend into a value only if something below node was requested, and
+ * remember where it is if node itself was
+ */
+static const unsigned char*
+scan_value(struct scan_ctx *ctx, const unsigned char *p, path_trie_t *node)
+{
+    const unsigned char *start = p;
+
+    node->scanned = true;
+    if (node->children != NULL && p < ctx->end && *p == '{') {
+	p = scan_object(ctx, p + 1, node);
+    } else if (node->children != NULL && p < ctx->end && *p == '[') {
+	p = scan_array(ctx, p + 1, node);
+    } else {
+	p = scan_skip(p, ctx->end);
+    }
+    if (p != NULL && node->terminal) {
+	node->scan_off = start - ctx->base;
+	node->scan_len = p - start;
+	ctx->remaining--;
+    }
+
+    return p;
+}
+
+/*
+ * The same for msgpack, where skipping needs no validation: map entries that
+ * were not asked for are stepped over by their encoded sizes and nothing is
+ * decoded.  Returns the size of the value, or -1 if it can not be walked.
+ * There is no stopping early, the rest of each map is checked for a second
+ * copy of a key that was walked.
+ */
+static ssize_t
+scan_msgpack(struct scan_ctx *ctx, const unsigned char *p, path_trie_t *node)
+{
+    path_trie_t *child;
+    ucl_type_t type, ktype;
+    uint64_t count, klen, k;
+    size_t left = ctx->end - p, pos;
+    ssize_t r;
+
+    node->scanned = true;
+    pos = 0;
+    if (node->children != NULL &&
+	(pos = msgpack_header(p, left, &type, &count)) > 0 &&
+	(type == UCL_OBJECT || type == UCL_ARRAY)) {
+	for (k = 0; k < count; k++) {
+	    if (type == UCL_OBJECT) {
+		/* Keys that are not strings are left to libucl */
+		r = msgpack_header(p + pos, left - pos, &ktype, &klen);
+		if (r == 0 || ktype != UCL_STRING || klen > left - pos - r) {
+		    return -1;
+		}
+		child = scan_child(node, p + pos + r, klen);
+		if (child == NULL && scan_repeated(node, p + pos + r, klen)) {
+		    if (debug > 0) {
+			fprintf(stderr, "DEBUG: Repeated key %.*s\n",
+			    (int)klen, p + pos + r);
+		    }
+		    return -1;
+		}
+		pos += r + klen;
+	    } else {
+		child = scan_child_index(node, k);
+	    }
+	    if (child != NULL) {
+		r = scan_msgpack(ctx, p + pos, child);
+	    } else {
+		r = msgpack_skip(p + pos, left - pos);
+	    }
+	    if (r <= 0) {
+		return -1;
+	    }
+	    pos += r;
+	}
+    } else {
+	pos = msgpack_skip(p, left);
+	if ((ssize_t)pos <= 0) {
+	    return -1;
+	}
+    }
+    if (node->terminal) {
+	node->scan_off = p - ctx->base;
+	node->scan_len = pos;
+	ctx->remaining--;
+    }
+
+    return pos;
+}
+
+static int
+scan_count(const path_trie_t *node)
+{
+    const path_trie_t *child;
+    int count = node->terminal ? 1 : 0;
+
+    for (child = node->children; child != NULL; child = child->next) {
+	count += scan_count(child);
+    }
+
+    return count;
+}
+
+/*
+ * Copy each value found into one document keyed by the order the nodes are
+ * visited in: {"0": <value>, "1": <value>, ...}, in JSON or msgpack.  The
+ * msgpack map header is left for the caller to fill in.
+ */
+static void
+scan_wrap(const path_trie_t *node, const unsigned char *base, bool msgpack,
+    char **buf, size_t *len, size_t *size, int *index)
+{
+    const path_trie_t *child;
+    char key[32];
+    int klen;
+
+    if (node->terminal && node->scanned) {
+	if (msgpack) {
+	    klen = snprintf(key + 2, sizeof(key) - 2, "%d", (*index)++);
+	    key[0] = 0xd9;	/* str 8 */
+	    key[1] = klen;
+	    klen += 2;
+	} else {
+	    klen = snprintf(key, sizeof(key), "%s\"%d\":",
+		*index > 0 ? "," : "", *index);
+	    (*index)++;
+	}
+	while (*len + klen + node->scan_len + 1 > *size) {
+	    *size *= 2;
+	    *buf = realloc(*buf, *size);
+	    if (*buf == NULL) {
+		fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n",
+		    ENOMEM);
+		abort();
+	    }
+	}
+	memcpy(*buf + *len, key, klen);
+	*len += klen;
+	memcpy(*buf + *len, base + node->scan_off, node->scan_len);
+	*len += node->scan_len;
+    }
+    for (child = node->children; child != NULL; child = child->next) {
+	scan_wrap(child, base, msgpack, buf, len, size, index);
+    }
+}
+
+static void
+scan_attach(path_trie_t *node, const ucl_object_t *top, int *index)
+{
+    path_trie_t *child;
+    char key[32];
+
+    if (node->terminal && node->scanned) {
+	snprintf(key, sizeof(key), "%d", (*index)++);
+	node->obj = ucl_object_lookup(top, key);
+    } else {
+	node->obj = NULL;
+    }
+    for (child = node->children; child != NULL; child = child->next) {
+	scan_attach(child, top, index);
+    }
+}
+
+/*
+ * Resolve every terminal node of trie from filename (stdin if NULL or "-")
+ * without parsing all of it.  msgpack is always walked, JSON only if json
+ * is set.  On success root_obj holds the values found and each terminal
+ * node's obj is set, as trie_resolve() would have.  Returns false, having
+ * consumed nothing, if the input has to go to the full parser.
+ */
+bool
+scan_file(const char *filename, path_trie_t *trie, bool json)
+{
+    struct scan_ctx ctx;
+    struct stat st;
+    enum ucl_parse_type type;
+    const unsigned char *p = NULL;
+    unsigned char *map;
+    char realbuf[PATH_MAX], *buf;
+    size_t len, size;
+    ssize_t r;
+    int fd, index;
+
+    if ((pflags & UCL_PARSER_KEY_LOWERCASE) != 0) {
+	return false;
+    }
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+	fd = STDIN_FILENO;
+    } else if ((fd = open(filename, O_RDONLY)) == -1) {
+	return false;
+    }
+    /* Pipes cannot be walked in place, they go to the full parser */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+	if (fd != STDIN_FILENO) {
+	    close(fd);
+	}
+	return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (fd != STDIN_FILENO) {
+	close(fd);
+    }
+    if (map == MAP_FAILED) {
+	return false;
+    }
+
+    ctx.base = map;
+    ctx.end = map + st.st_size;
+    ctx.remaining = scan_count(trie);
+    type = detect_input_format(map, st.st_size);
+    if (type == UCL_PARSE_MSGPACK) {
+	/* Only the pages on the way to each value are touched */
+	(void)madvise(map, st.st_size, MADV_RANDOM);
+	r = scan_msgpack(&ctx, ctx.base, trie);
+	if (r > 0) {
+	    p = ctx.base + r;
+	}
+    } else if (json) {
+	(void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+	p = scan_ws(ctx.base, ctx.end);
+	if (p < ctx.end && (*p == '{' || *p == '[')) {
+	    p = scan_value(&ctx, p, trie);
+	    if (p != NULL && ctx.remaining > 0 &&
+		scan_ws(p, ctx.end) != ctx.end) {
+		/* Trailing data, this is not a single JSON document */
+		p = NULL;
+	    }
+	} else {
+	    p = NULL;
+	}
+    }
+    if (p == NULL) {
+	if (debug > 0 && (json || type == UCL_PARSE_MSGPACK)) {
+	    fprintf(stderr, "DEBUG: %s is not plain %s, parsing it\n",
+		filename != NULL ? filename : "stdin",
+		type == UCL_PARSE_MSGPACK ? "msgpack" : "JSON");
+	}
+	munmap(map, st.st_size);
+	return false;
+    }
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Scanned %zu of %jd bytes\n",
+	    (size_t)(p - ctx.base), (intmax_t)st.st_size);
+    }
+
+    size = 4096;
+    buf = malloc(size);
+    if (buf == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    /* A msgpack map 32 header, the count is filled in below */
+    len = type == UCL_PARSE_MSGPACK ? 5 : 1;
+    buf[0] = type == UCL_PARSE_MSGPACK ? 0xdf : '{';
+    index = 0;
+    scan_wrap(trie, ctx.base, type == UCL_PARSE_MSGPACK, &buf, &len, &size,
+	&index);
+    munmap(map, st.st_size);
+    if (type == UCL_PARSE_MSGPACK) {
+	buf[1] = (index >> 24) & 0xff;
+	buf[2] = (index >> 16) & 0xff;
+	buf[3] = (index >> 8) & 0xff;
+	buf[4] = index & 0xff;
+    } else {
+	buf[len++] = '}';
+	type = UCL_PARSE_UCL;
+    }
+
+    if (filename != NULL && strcmp(filename, "-") != 0) {
+	if (realpath(filename, realbuf) == NULL) {
+	    snprintf(realbuf, sizeof(realbuf), "%s", filename);
+	}
+	ucl_parser_set_filevars(parser, realbuf, false);
+    }
+    if (!parse_chunk(parser, (unsigned char *)buf, len, type)) {
+	fprintf(stderr, "Error occured: %s\n", ucl_parser_get_error(parser));
+	free(buf);
+	cleanup();
+	exit(2);
+    }
+    free(buf);
+    root_obj = ucl_parser_get_object(parser);
+
+    index = 0;
+    scan_attach(trie, root_obj, &index);
+
+    return true;
+}
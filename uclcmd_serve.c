@@ -0,0 +1,546 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * uclcmd serve keeps the parsed trees of a set of files in memory and runs
+ * requests sent by "uclcmd --connect" against them.
+ *
+ * The client sends its working directory and argument vector over a unix
+ * socket along with its stdin, stdout and stderr (SCM_RIGHTS).  For each
+ * request the server forks: the child inherits the resident trees, points
+ * its standard descriptors at the client's and runs the verb exactly as
+ * uclcmd would, so options, output and error handling are all unchanged.
+ * parse_file() hands out the resident tree instead of parsing when the
+ * file and parser flags match.  The child's exit status is sent back and
+ * becomes the exit status of the client.
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "uclcmd.h"
+
+#define	SERVE_MAX_REQUEST	(1024 * 1024)
+
+struct serve_hdr {
+	uint32_t	len;	/* bytes of payload that follow */
+	uint32_t	argc;	/* strings in the payload after the cwd */
+};
+
+struct served_file {
+	char		*path;
+	int		flags;
+	struct stat	st;
+	ucl_object_t	*obj;
+};
+
+static struct served_file *served = NULL;
+static int nserved = 0;
+static const char *socket_path = NULL;
+
+static void
+serve_signal(int sig)
+{
+
+    if (socket_path != NULL) {
+	unlink(socket_path);
+    }
+    _exit(0);
+}
+
+static bool
+serve_io(int fd, void *data, size_t len, bool reading)
+{
+    unsigned char *p = data;
+    ssize_t r;
+
+    while (len > 0) {
+	if (reading) {
+	    r = read(fd, p, len);
+	} else {
+	    r = write(fd, p, len);
+	}
+	if (r < 0 && errno == EINTR) {
+	    continue;
+	} else if (r <= 0) {
+	    return false;
+	}
+	p += r;
+	len -= r;
+    }
+
+    return true;
+}
+
+/*
+ * (Re)load a served file if it is new or has changed on disk.  A file that
+ * fails to parse keeps serving its last good tree.
+ */
+static void
+serve_refresh(struct served_file *sf)
+{
+    struct ucl_parser *sparser = NULL;
+    ucl_object_t *obj = NULL;
+    struct stat st;
+    int error = 0;
+
+    if (stat(sf->path, &st) != 0) {
+	fprintf(stderr, "Warning: cannot stat %s: %s\n", sf->path,
+	    strerror(errno));
+	return;
+    }
+    if (sf->obj != NULL && st.st_dev == sf->st.st_dev &&
+	    st.st_ino == sf->st.st_ino && st.st_size == sf->st.st_size &&
+	    st.st_mtim.tv_sec == sf->st.st_mtim.tv_sec &&
+	    st.st_mtim.tv_nsec == sf->st.st_mtim.tv_nsec) {
+	return;
+    }
+
+    sparser = ucl_parser_new(sf->flags);
+    obj = parse_file_common(sparser, sf->path, &error);
+    ucl_parser_free(sparser);
+    if (obj == NULL) {
+	fprintf(stderr, "Warning: keeping the previous version of %s\n",
+	    sf->path);
+	return;
+    }
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: %s %s\n", sf->obj == NULL ? "Loaded" :
+	    "Reloaded", sf->path);
+    }
+    ucl_object_unref(sf->obj);
+    sf->obj = obj;
+    sf->st = st;
+}
+
+/*
+ * Called from parse_file(), returns a reference to the resident tree for
+ * filename if this is a request being run by uclcmd serve
+ */
+ucl_object_t*
+serve_lookup(const char *filename)
+{
+    char realbuf[PATH_MAX];
+    int i;
+
+    if (nserved == 0 || realpath(filename, realbuf) == NULL) {
+	return NULL;
+    }
+    for (i = 0; i < nserved; i++) {
+	if (served[i].obj == NULL ||
+		served[i].flags != (UCLCMD_PARSER_FLAGS | pflags) ||
+		strcmp(served[i].path, realbuf) != 0) {
+	    continue;
+	}
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Using resident tree for %s\n", realbuf);
+	}
+	return ucl_object_ref(served[i].obj);
+    }
+
+    return NULL;
+}
+
+static bool
+serve_recv(int conn, struct serve_hdr *hdr, int fds[3], char **payload)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+	struct cmsghdr	hdr;
+	char		buf[CMSG_SPACE(3 * sizeof(int))];
+    } cmsgbuf;
+    ssize_t r;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(*hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    do {
+	r = recvmsg(conn, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+    if (r != sizeof(*hdr)) {
+	return false;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+	return false;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    if (hdr->len == 0 || hdr->len > SERVE_MAX_REQUEST) {
+	return false;
+    }
+    *payload = malloc(hdr->len);
+    if (*payload == NULL) {
+	return false;
+    }
+    if (!serve_io(conn, *payload, hdr->len, true) ||
+	    (*payload)[hdr->len - 1] != '\0') {
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * Runs in a child of the server: receive one request, run it in a further
+ * child and report its exit status.
+ */
+static void
+serve_request(int conn)
+{
+    struct serve_hdr hdr;
+    char *payload = NULL, *p, *cwd;
+    char **args = NULL;
+    int fds[3] = { -1, -1, -1 };
+    int32_t ret;
+    uint32_t i;
+    pid_t worker;
+    int status;
+
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (!serve_recv(conn, &hdr, fds, &payload)) {
+	if (debug > 0) {
+	    fprintf(stderr, "DEBUG: Dropping malformed request\n");
+	}
+	_exit(1);
+    }
+
+    /* cwd, then argc strings */
+    args = calloc(hdr.argc + 1, sizeof(char *));
+    if (args == NULL || hdr.argc < 2) {
+	_exit(1);
+    }
+    cwd = p = payload;
+    for (i = 0; i < hdr.argc; i++) {
+	p += strlen(p) + 1;
+	if (p >= payload + hdr.len) {
+	    _exit(1);
+	}
+	args[i] = p;
+    }
+    if (strcasecmp(args[1], "serve") == 0 ||
+	    strcasecmp(args[1], "--connect") == 0) {
+	dprintf(fds[2], "Error: %s can not be run through the server\n",
+	    args[1]);
+	ret = 1;
+	serve_io(conn, &ret, sizeof(ret), false);
+	_exit(1);
+    }
+
+    worker = fork();
+    if (worker == 0) {
+	for (i = 0; i < 3; i++) {
+	    dup2(fds[i], i);
+	}
+	for (i = 0; i < 3; i++) {
+	    if (fds[i] > 2)
+		close(fds[i]);
+	}
+	close(conn);
+	if (chdir(cwd) != 0) {
+	    fprintf(stderr, "Error: cannot chdir to %s: %s\n", cwd,
+		strerror(errno));
+	    exit(1);
+	}
+	/* Start the verb from a clean slate */
+	debug = 0;
+	pflags = 0;
+	input_format = UCL_PARSE_AUTO;
+	/* With one file served, get reads it unless given another */
+	if (nserved == 1 && strcasecmp(args[1], "get") == 0) {
+	    filename = served[0].path;
+	}
+#ifdef __GLIBC__
+	optind = 0;
+#else
+	optreset = 1;
+	optind = 1;
+#endif
+	exit(verb_main(hdr.argc, args));
+    }
+
+    for (i = 0; i < 3; i++) {
+	close(fds[i]);
+    }
+    if (worker == -1) {
+	ret = 1;
+    } else {
+	while (waitpid(worker, &status, 0) == -1 && errno == EINTR)
+	    ;
+	if (WIFEXITED(status)) {
+	    ret = WEXITSTATUS(status);
+	} else {
+	    ret = 128 + WTERMSIG(status);
+	}
+    }
+    serve_io(conn, &ret, sizeof(ret), false);
+    _exit(0);
+}
+
+int
+serve_main(int argc, char *argv[])
+{
+    struct sockaddr_un sun;
+    int ch, i, listenfd, conn, error;
+    mode_t oldmask;
+    pid_t pid;
+
+    /*	options	descriptor */
+    static struct option longopts[] = {
+	{ "debug",	optional_argument,	NULL,		'd' },
+	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
+	{ "socket",	required_argument,	NULL,		's' },
+	{ NULL,		0,			NULL,		0 }
+    };
+
+    while ((ch = getopt_long(argc, argv, "dIs:", longopts, NULL)) != -1) {
+	switch (ch) {
+	case 'd':
+	    if (optarg != NULL) {
+		debug = strtol(optarg, NULL, 0);
+	    } else {
+		debug = 1;
+	    }
+	    break;
+	case 'I':
+	    pflags |= UCL_PARSER_KEY_LOWERCASE;
+	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
+	case 's':
+	    socket_path = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Error: Unexpected option: %i\n", ch);
+	    usage();
+	    break;
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc == 0 || socket_path == NULL) {
+	usage();
+    }
+    if (strlen(socket_path) >= sizeof(sun.sun_path)) {
+	fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+	exit(1);
+    }
+
+    served = calloc(argc, sizeof(*served));
+    if (served == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    for (i = 0; i < argc; i++) {
+	served[i].path = realpath(argv[i], NULL);
+	if (served[i].path == NULL) {
+	    fprintf(stderr, "Error: cannot find %s: %s\n", argv[i],
+		strerror(errno));
+	    exit(2);
+	}
+	served[i].flags = UCLCMD_PARSER_FLAGS | pflags;
+	serve_refresh(&served[i]);
+	if (served[i].obj == NULL) {
+	    exit(3);
+	}
+    }
+    nserved = argc;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, socket_path, sizeof(sun.sun_path) - 1);
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd == -1) {
+	fprintf(stderr, "Error: cannot create socket: %s\n", strerror(errno));
+	exit(7);
+    }
+    unlink(socket_path);
+    /*
+     * Only the owner may talk to the server.  The mask is put back so that
+     * files written for requests get the usual permissions.
+     */
+    oldmask = umask(077);
+    error = bind(listenfd, (struct sockaddr *)&sun, sizeof(sun));
+    umask(oldmask);
+    if (error != 0 || listen(listenfd, SOMAXCONN) != 0) {
+	fprintf(stderr, "Error: cannot listen on %s: %s\n", socket_path,
+	    strerror(errno));
+	exit(7);
+    }
+    signal(SIGINT, serve_signal);
+    signal(SIGTERM, serve_signal);
+    signal(SIGPIPE, SIG_IGN);
+    /* Request handlers are never waited for */
+    signal(SIGCHLD, SIG_IGN);
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Serving %d file(s) on %s\n", nserved,
+	    socket_path);
+    }
+
+    for (;;) {
+	conn = accept(listenfd, NULL, NULL);
+	if (conn == -1) {
+	    if (errno != EINTR && errno != ECONNABORTED) {
+		fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+	    }
+	    continue;
+	}
+	/* Make sure the request sees current versions of every file */
+	for (i = 0; i < nserved; i++) {
+	    serve_refresh(&served[i]);
+	}
+	pid = fork();
+	if (pid == 0) {
+	    close(listenfd);
+	    serve_request(conn);
+	} else if (pid == -1) {
+	    fprintf(stderr, "Error: fork failed: %s\n", strerror(errno));
+	}
+	close(conn);
+    }
+
+    return(0);
+}
+
+/*
+ * uclcmd --connect socket verb [options] ...
+ * Hand the request to a running uclcmd serve and exit with its status
+ */
+int
+connect_main(int argc, char *argv[])
+{
+    struct sockaddr_un sun;
+    struct serve_hdr hdr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+	struct cmsghdr	hdr;
+	char		buf[CMSG_SPACE(3 * sizeof(int))];
+    } cmsgbuf;
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char cwd[PATH_MAX];
+    char *payload = NULL, *p;
+    size_t len;
+    int32_t ret;
+    int i, sock;
+
+    if (argc < 3) {
+	usage();
+    }
+    if (strlen(argv[1]) >= sizeof(sun.sun_path)) {
+	fprintf(stderr, "Error: socket path too long: %s\n", argv[1]);
+	exit(1);
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+	fprintf(stderr, "Error: cannot get current directory: %s\n",
+	    strerror(errno));
+	exit(1);
+    }
+
+    /* cwd, program name, then the verb and its arguments */
+    len = strlen(cwd) + 1 + strlen(argv[0]) + 1;
+    for (i = 2; i < argc; i++) {
+	len += strlen(argv[i]) + 1;
+    }
+    if (len > SERVE_MAX_REQUEST) {
+	fprintf(stderr, "Error: request too large\n");
+	exit(1);
+    }
+    p = payload = malloc(len);
+    if (payload == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+    p = stpcpy(p, cwd) + 1;
+    p = stpcpy(p, argv[0]) + 1;
+    for (i = 2; i < argc; i++) {
+	p = stpcpy(p, argv[i]) + 1;
+    }
+    hdr.len = len;
+    hdr.argc = argc - 1;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, argv[1], sizeof(sun.sun_path) - 1);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 ||
+	    connect(sock, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+	fprintf(stderr, "Error: cannot connect to %s: %s\n", argv[1],
+	    strerror(errno));
+	exit(7);
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(sock, &msg, 0) != sizeof(hdr) ||
+	    !serve_io(sock, payload, len, false)) {
+	fprintf(stderr, "Error: failed to send request: %s\n",
+	    strerror(errno));
+	exit(7);
+    }
+    free(payload);
+
+    if (!serve_io(sock, &ret, sizeof(ret), true)) {
+	fprintf(stderr, "Error: server closed the connection\n");
+	exit(7);
+    }
+    close(sock);
+
+    return(ret);
+}
@@ -43,6 +43,7 @@ set_main(int argc, char *argv[])
 
     /*	options	descriptor */
     static struct option longopts[] = {
+	{ "canonical",	no_argument,		&canonical,	1 },
 	{ "cjson",	no_argument,		&output_type,
 	    UCL_EMIT_JSON_COMPACT },
 	{ "debug",	optional_argument,	NULL,		'd' },
@@ -54,6 +55,7 @@ set_main(int argc, char *argv[])
 	{ "keys",	no_argument,		&show_keys,	1 },
 	{ "input",	no_argument,		NULL,		'i' },
 	{ "foldcase",	no_argument,		NULL,		'I' },
+	{ "input-format", required_argument,	NULL,		'F' },
 	{ "msgpack",	no_argument,		&output_type,
 	    UCL_EMIT_MSGPACK },
 	{ "noop",	no_argument,		&noop,		1 },
@@ -96,6 +98,9 @@ set_main(int argc, char *argv[])
 	case 'I':
 	    pflags |= UCL_PARSER_KEY_LOWERCASE;
 	    break;
+	case 'F':
+	    input_format = string_to_format(optarg);
+	    break;
 	case 'j':
 	    output_type = UCL_EMIT_JSON;
 	    break;
@@ -166,14 +171,14 @@ set_main(int argc, char *argv[])
 	if (noop == 0) {
 	    if (outfile == NULL && filename != NULL) {
 		outfile = filename;
-		success = replace_file(root_obj, "", "", outfile);
+		success = replace_file(root_obj, outfile);
 		if (success != 0) {
 		    fprintf(stderr, "Error: failed to write the changes to %s\n",
 			outfile);
 		    exit(7);
 		}
 	    } else {
-		output_chunk(root_obj, "", "");
+		output_chunk(root_obj, &nodepath_root, 0);
 	    }
 	} else {
 	    get_mode("");
@@ -209,7 +214,9 @@ set_mode(char *destination_node, char *data, ucl_type_t want_type)
 	return false;
     }
 
-    if (include_file != NULL) {
+    if (set_obj != NULL) {
+	/* Already built by the caller (patch) */
+    } else if (include_file != NULL) {
 	/* get UCL to add from file */
 	set_obj = parse_file(setparser, include_file);
     } else if (data == NULL || strcmp(data, "-") == 0) {
@@ -313,6 +320,7 @@ set_mode(char *destination_node, char *data, ucl_type_t want_type)
 	if (sub_obj == dst_obj) {
 	    /* Sub-object does not exist, create a new one */
 	    success = ucl_array_append(dst_obj, set_obj);
+	    set_obj = NULL;
 	} else {
 	    old_obj = ucl_array_replace_index(dst_obj, set_obj, strtoul(dst_frag,
 		NULL, 0));
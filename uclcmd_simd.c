@@ -0,0 +1,362 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Structural classification for --scan
+ *
+ * Skipping a value that was not asked for is most of the work of a scan.
+ * Rather than stepping through it a byte at a time, the input is classified
+ * 64 bytes at a time into bitmasks of quotes, backslashes, opening and
+ * closing brackets and bytes that cannot appear in JSON outside a string.
+ * Escaped quotes are removed, a prefix xor of the quotes gives the bytes
+ * inside strings, and only the brackets left over have to be visited to
+ * find where the value ends.
+ *
+ * The classification is done with AVX2 or SSE2 when the CPU has them.
+ * Otherwise, or on other architectures, a plain byte at a time loop is
+ * faster than emulating the masks, so that is used instead.  The choice is
+ * made once at run time.
+ */
+
+#include "uclcmd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define	STRUCT_X86	1
+#include <immintrin.h>
+#endif
+
+typedef const unsigned char* (*skip_func_t)(const unsigned char *p,
+    const unsigned char *end);
+
+static const unsigned char* skip_init(const unsigned char *p,
+    const unsigned char *end);
+static skip_func_t skip_impl = skip_init;
+
+/*
+ * Outside of strings JSON only has whitespace, brackets, ',', ':' and the
+ * characters of numbers, true, false and null.
+ */
+static inline bool
+json_bare(unsigned char c)
+{
+
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+	c == '{' || c == '}' || c == '[' || c == ']' ||
+	(c >= '+' && c <= '.') || (c >= '0' && c <= ':') || isalpha(c);
+}
+
+static const unsigned char*
+skip_c(const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *q, *b;
+    int depth = 0;
+
+    for (; p < end; p++) {
+	switch (*p) {
+	case '"':
+	    /* Find the closing quote, skipping escaped ones */
+	    for (q = p + 1; (q = memchr(q, '"', end - q)) != NULL; q++) {
+		for (b = q; b[-1] == '\\'; b--)
+		    ;
+		if (((q - b) & 1) == 0)
+		    break;
+	    }
+	    if (q == NULL) {
+		return NULL;
+	    }
+	    p = q;
+	    break;
+	case '{':
+	case '[':
+	    depth++;
+	    break;
+	case '}':
+	case ']':
+	    if (--depth == 0) {
+		return p + 1;
+	    }
+	    break;
+	default:
+	    if (!json_bare(*p)) {
+		return NULL;
+	    }
+	    break;
+	}
+    }
+
+    return NULL;
+}
+
+#ifdef STRUCT_X86
+typedef struct struct_masks {
+	uint64_t	quote;
+	uint64_t	backslash;
+	uint64_t	open;		/* { and [ */
+	uint64_t	close;		/* } and ] */
+	uint64_t	bad;		/* not JSON outside of a string */
+} struct_masks_t;
+
+/*
+ * Folding case with 0x20 maps '[' and ']' onto '{' and '}' and the upper
+ * case letters onto lower case.
+ */
+__attribute__((target("sse2")))
+static inline __m128i
+sse2_range(__m128i v, char lo, char hi)
+{
+
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+	_mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+__attribute__((target("sse2")))
+static void
+classify_sse2(const unsigned char *block, struct_masks_t *m)
+{
+    __m128i v, lv, ok, open, close;
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < 64; i += 16) {
+	v = _mm_loadu_si128((const __m128i *)(block + i));
+	lv = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	open = _mm_cmpeq_epi8(lv, _mm_set1_epi8('{'));
+	close = _mm_cmpeq_epi8(lv, _mm_set1_epi8('}'));
+	ok = _mm_or_si128(open, close);
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+	ok = _mm_or_si128(ok, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+	ok = _mm_or_si128(ok, sse2_range(v, '+', '.'));
+	ok = _mm_or_si128(ok, sse2_range(v, '0', ':'));
+	ok = _mm_or_si128(ok, sse2_range(lv, 'a', 'z'));
+	m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+	m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+	m->open |= (uint64_t)(uint16_t)_mm_movemask_epi8(open) << i;
+	m->close |= (uint64_t)(uint16_t)_mm_movemask_epi8(close) << i;
+	m->bad |= (uint64_t)(uint16_t)~_mm_movemask_epi8(ok) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_range(__m256i v, char lo, char hi)
+{
+
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+	_mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+__attribute__((target("avx2")))
+static void
+classify_avx2(const unsigned char *block, struct_masks_t *m)
+{
+    __m256i v, lv, ok, open, close;
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < 64; i += 32) {
+	v = _mm256_loadu_si256((const __m256i *)(block + i));
+	lv = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+	open = _mm256_cmpeq_epi8(lv, _mm256_set1_epi8('{'));
+	close = _mm256_cmpeq_epi8(lv, _mm256_set1_epi8('}'));
+	ok = _mm256_or_si256(open, close);
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+	ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+	ok = _mm256_or_si256(ok, avx2_range(v, '+', '.'));
+	ok = _mm256_or_si256(ok, avx2_range(v, '0', ':'));
+	ok = _mm256_or_si256(ok, avx2_range(lv, 'a', 'z'));
+	m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+	    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+	m->backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+	    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+	m->open |= (uint64_t)(uint32_t)_mm256_movemask_epi8(open) << i;
+	m->close |= (uint64_t)(uint32_t)_mm256_movemask_epi8(close) << i;
+	m->bad |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(ok) << i;
+    }
+}
+
+/*
+ * Bytes preceded by an odd number of backslashes, escaped says whether the
+ * first byte of the block is and is updated for the next block
+ */
+static inline uint64_t
+struct_escaped(uint64_t backslash, uint64_t *escaped)
+{
+    uint64_t mask = 0;
+    int i;
+
+    if (*escaped) {
+	mask = 1;
+	backslash &= ~1ULL;
+    }
+    *escaped = 0;
+    while (backslash != 0) {
+	i = __builtin_ctzll(backslash);
+	if (i == 63) {
+	    *escaped = 1;
+	    break;
+	}
+	mask |= 1ULL << (i + 1);
+	backslash &= ~(3ULL << i);
+    }
+
+    return mask;
+}
+
+static inline uint64_t
+prefix_xor(uint64_t x)
+{
+
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+
+    return x;
+}
+
+typedef void (*classify_func_t)(const unsigned char *block,
+    struct_masks_t *m);
+
+/*
+ * Find the end of a container 64 bytes at a time, inlined into a copy for
+ * each instruction set so that classify is a direct call
+ */
+static inline __attribute__((always_inline)) const unsigned char*
+skip_blocks(const unsigned char *p, const unsigned char *end,
+    classify_func_t classify)
+{
+    struct_masks_t m;
+    unsigned char tail[64];
+    const unsigned char *block;
+    uint64_t escaped = 0, instring = 0, inside, brackets, bad, bit;
+    size_t left;
+    int depth = 0, i;
+
+    for (; p < end; p += 64) {
+	left = end - p;
+	if (left >= 64) {
+	    block = p;
+	} else {
+	    /* Pad the last block with whitespace */
+	    memset(tail, ' ', sizeof(tail));
+	    memcpy(tail, p, left);
+	    block = tail;
+	}
+	classify(block, &m);
+	if (m.backslash != 0 || escaped != 0) {
+	    m.quote &= ~struct_escaped(m.backslash, &escaped);
+	}
+	/* Set from each opening quote up to its closing quote */
+	inside = prefix_xor(m.quote) ^ instring;
+	instring = (uint64_t)((int64_t)inside >> 63);
+	bad = m.bad & ~inside;
+	brackets = (m.open | m.close) & ~inside;
+	while (brackets != 0) {
+	    i = __builtin_ctzll(brackets);
+	    bit = 1ULL << i;
+	    depth += (m.open & bit) ? 1 : -1;
+	    if (depth == 0) {
+		if ((bad & (bit - 1)) != 0) {
+		    return NULL;
+		}
+		return p + i + 1;
+	    }
+	    brackets &= brackets - 1;
+	}
+	if (bad != 0) {
+	    return NULL;
+	}
+    }
+
+    return NULL;
+}
+
+/* The same walk, compiled once for each instruction set */
+__attribute__((target("sse2")))
+static const unsigned char*
+skip_sse2(const unsigned char *p, const unsigned char *end)
+{
+
+    return skip_blocks(p, end, classify_sse2);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char*
+skip_avx2(const unsigned char *p, const unsigned char *end)
+{
+
+    return skip_blocks(p, end, classify_avx2);
+}
+#endif
+
+/* Pick an implementation on first use */
+static const unsigned char*
+skip_init(const unsigned char *p, const unsigned char *end)
+{
+    const char *name = "C";
+
+    skip_impl = skip_c;
+#ifdef STRUCT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	skip_impl = skip_avx2;
+	name = "AVX2";
+    } else if (__builtin_cpu_supports("sse2")) {
+	skip_impl = skip_sse2;
+	name = "SSE2";
+    }
+#endif
+    if (debug > 0) {
+	fprintf(stderr, "DEBUG: Skipping values with %s\n", name);
+    }
+
+    return skip_impl(p, end);
+}
+
+/*
+ * p points at a '{' or '[', return the byte after the bracket that closes
+ * it, or NULL if the input ends first or has something that is not JSON
+ * outside of a string.  Brackets are not checked to be of the same kind.
+ */
+const unsigned char*
+structural_skip(const unsigned char *p, const unsigned char *end)
+{
+
+    return skip_impl(p, end);
+}
@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2014-2015 Allan Jude <allanjude@freebsd.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+
+/*
+ * Prefix trie of requested paths
+ *
+ * When get is given many paths, they are split into segments and merged
+ * into a trie so that a prefix shared by several of them ("vm.net.0.mac",
+ * "vm.net.0.ip") is only looked up once.  The trie is then resolved against
+ * a tree in a single walk, and each query reads its object from its node.
+ */
+
+#include "uclcmd.h"
+
+path_trie_t*
+trie_new(void)
+{
+    path_trie_t *node;
+
+    node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+	fprintf(stderr, "ENOMEM(%d): Could not allocate memory.\n", ENOMEM);
+	abort();
+    }
+
+    return node;
+}
+
+/*
+ * Add path to the trie and return the node for its final segment.  Empty
+ * segments are skipped, as ucl_lookup_path_char() does.
+ */
+path_trie_t*
+trie_insert(path_trie_t *root, const char *path)
+{
+    path_trie_t *node = root, *child = NULL;
+    const char *seg = path, *end = NULL;
+    size_t len;
+
+    while (*seg != '\0') {
+	end = strchr(seg, input_sepchar);
+	if (end == NULL) {
+	    end = seg + strlen(seg);
+	}
+	len = end - seg;
+	if (len > 0) {
+	    for (child = node->children; child != NULL; child = child->next) {
+		if (child->seglen == len && memcmp(child->seg, seg, len) == 0)
+		    break;
+	    }
+	    if (child == NULL) {
+		child = trie_new();
+		child->seg = strndup(seg, len);
+		child->seglen = len;
+		child->depth = node->depth + 1;
+		child->parent = node;
+		child->next = node->children;
+		node->children = child;
+	    }
+	    node = child;
+	}
+	if (*end == '\0') {
+	    break;
+	}
+	seg = end + 1;
+    }
+    node->terminal = true;
+
+    return node;
+}
+
+/*
+ * Walk obj once, resolving every node below (and including) node
+ */
+void
+trie_resolve(path_trie_t *node, const ucl_object_t *obj)
+{
+    path_trie_t *child;
+
+    node->obj = obj;
+    for (child = node->children; child != NULL; child = child->next) {
+	trie_resolve(child, lookup_segment(obj, child->seg, child->seglen));
+    }
+}
+
+void
+trie_free(path_trie_t *node)
+{
+    path_trie_t *child, *next;
+
+    if (node == NULL) {
+	return;
+    }
+    for (child = node->children; child != NULL; child = next) {
+	next = child->next;
+	trie_free(child);
+    }
+    free(node->seg);
+    free(node);
+}